@@ -0,0 +1,843 @@
+// Benchmark suite for sfs, ssdb, sstl, crypto and sockets.
+// Output: one JSON object per line, suitable for tracking across versions:
+// {"name": "...", "iterations": N, "ns_per_op": X, "bytes_per_sec": Y}
+// Usage: bench [--full] [--dir path] [--port port] [filter...]
+// --full: also run the largest sizes (10M keys), filters select benchmarks by name prefix.
+// Build example (from the repository root):
+// c++ -std=c++14 -O2 -Isrc bench/bench.cpp src/to_pubkey.cpp src/to_socket.cpp src/util/sfs.cpp src/util/ssdb.cpp src/util/curve25519.cpp src/util/metrics.cpp -lcrypto -lpthread
+// Limitation: the sources are only built with MSVC so far, GCC and Clang also need the following.
+// Flags: '-D__declspec(x)=' -DO_CREATE=O_CREAT -include dirent.h -include climits
+// Source patches: cast sock_opt<int> arguments of setsockopt to const char* (conversion is ambiguous),
+// use socklen_t for getsockopt/accept lengths and std::max<long> on send/recv results in to_socket.cpp.
+
+#include "to_pubkey.hpp"
+#include "to_socket.hpp"
+#include "util/sfs.hpp"
+#include "util/ssdb.hpp"
+#include "util/sstl.hpp"
+#include "util/flat_map.hpp"
+#include "util/curve25519.hpp"
+#include <openssl/rand.h>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <array>
+#include <vector>
+#include <map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
+
+namespace
+{
+	// Minimal measuring time per benchmark
+	constexpr double s_min_time = 0.2;
+
+	bool g_full = false;
+
+	std::string g_dir = ".";
+
+	std::string g_port = "34650";
+
+	std::vector<std::string> g_filters;
+
+	// Prevent optimizing out the results
+	volatile std::size_t g_sink;
+
+	using clock_type = std::chrono::steady_clock;
+
+	double seconds(clock_type::time_point start)
+	{
+		return std::chrono::duration<double>(clock_type::now() - start).count();
+	}
+
+	bool enabled(const std::string& name)
+	{
+		if (g_filters.empty())
+		{
+			return true;
+		}
+
+		for (auto& f : g_filters)
+		{
+			if (name.compare(0, f.size(), f) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void report(const std::string& name, std::uint64_t iterations, double time, std::uint64_t bytes_per_op = 0)
+	{
+		std::printf("{\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.1f", name.c_str(), static_cast<unsigned long long>(iterations), time * 1e9 / iterations);
+
+		if (bytes_per_op)
+		{
+			std::printf(", \"bytes_per_sec\": %.0f", static_cast<double>(bytes_per_op) * iterations / time);
+		}
+
+		std::printf("}\n");
+		std::fflush(stdout);
+	}
+
+	// Run func(n) with growing n until it takes s_min_time (func performs n operations)
+	template <typename F>
+	void run(const std::string& name, std::uint64_t bytes_per_op, F&& func)
+	{
+		if (!enabled(name))
+		{
+			return;
+		}
+
+		for (std::uint64_t n = 1;; n *= 2)
+		{
+			const auto start = clock_type::now();
+			func(n);
+			const double time = seconds(start);
+
+			if (time >= s_min_time || n >= (1ull << 40))
+			{
+				report(name, n, time, bytes_per_op);
+				return;
+			}
+
+			// Jump closer to the target time
+			if (time * 8 < s_min_time && time > 0)
+			{
+				n = static_cast<std::uint64_t>(n * (s_min_time / time) / 4);
+			}
+		}
+	}
+
+	std::array<uchar, 32> random_key()
+	{
+		std::array<uchar, 32> key;
+		RAND_bytes(key.data(), 32);
+		return key;
+	}
+
+	std::string temp_path(const char* name)
+	{
+		return g_dir + "/" + name;
+	}
+
+	void bench_sfs()
+	{
+		if (!enabled("sfs/"))
+		{
+			return;
+		}
+
+		const auto key = random_key();
+		const std::string path = temp_path("bench.sfs");
+		std::remove(path.c_str());
+
+		auto view = sfs::make_view(path, key.data());
+
+		if (!view)
+		{
+			std::fprintf(stderr, "sfs: failed to open %s\n", path.c_str());
+			return;
+		}
+
+		// 16 MB storage
+		constexpr std::size_t count = 4096;
+		std::vector<uchar> buf(sfs::block_size * 64);
+		RAND_bytes(buf.data(), static_cast<int>(buf.size()));
+
+		for (std::size_t i = 0; i < count; i += 64)
+		{
+			view->write_blocks(i, 64, buf.data());
+		}
+
+		std::mt19937_64 rng(1);
+
+		run("sfs/write_block", sfs::block_size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				view->write_block(rng() % count, buf.data());
+			}
+		});
+
+		run("sfs/read_block", sfs::block_size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = view->read_block(rng() % count, buf.data());
+			}
+		});
+
+		run("sfs/write_blocks/64", sfs::block_size * 64, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				view->write_blocks(i * 64 % count, 64, buf.data());
+			}
+		});
+
+		run("sfs/scan", sfs::block_size * count, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				for (std::size_t b = 0; b < count; b += 64)
+				{
+					g_sink = view->read_blocks(b, 64, buf.data());
+				}
+			}
+		});
+
+		if (view->set_cache(count * sfs::block_size))
+		{
+			run("sfs/read_block/cached", sfs::block_size, [&](std::uint64_t n)
+			{
+				for (std::uint64_t i = 0; i < n; i++)
+				{
+					g_sink = view->read_block(rng() % count, buf.data());
+				}
+			});
+		}
+
+		view->set_delete();
+		view.reset();
+	}
+
+	template <template <typename...> class M>
+	void bench_umap(const char* prefix, std::size_t keys)
+	{
+		using db_type = ssdb::umap<std::uint64_t, std::string, std::hash<std::uint64_t>, M>;
+
+		const std::string suffix = "/" + std::to_string(keys);
+
+		if (!enabled(prefix + std::string("/insert") + suffix) && !enabled(prefix + std::string("/flush") + suffix) && !enabled(prefix + std::string("/reload") + suffix))
+		{
+			return;
+		}
+
+		const auto key = random_key();
+		const std::string path = temp_path("bench_umap.sfs");
+		std::remove(path.c_str());
+
+		const std::string value(64, 'v');
+
+		{
+			db_type db("bench", 5);
+			db.init(sfs::make_view(path, key.data()));
+
+			auto start = clock_type::now();
+
+			for (std::size_t i = 0; i < keys; i += 1000)
+			{
+				db.write([&](auto w)
+				{
+					for (std::size_t j = i; j < i + 1000 && j < keys; j++)
+					{
+						*w.add(j * 0x9e3779b97f4a7c15ull) = value;
+					}
+				});
+			}
+
+			report(prefix + std::string("/insert") + suffix, keys, seconds(start));
+
+			start = clock_type::now();
+			db.flush();
+			report(prefix + std::string("/flush") + suffix, keys, seconds(start), value.size() + 8);
+		}
+
+		{
+			const auto start = clock_type::now();
+			db_type db("bench", 5);
+			db.init(sfs::make_view(path, key.data()));
+			const double time = seconds(start);
+
+			// Check the key count and spot-check values out of the timed region
+			const bool ok = db.read([&](auto r)
+			{
+				std::size_t count = 0;
+
+				for (auto&& pair : r)
+				{
+					static_cast<void>(pair);
+					count++;
+				}
+
+				std::string loaded;
+
+				for (std::size_t i = 0; i < keys; i += keys / 100)
+				{
+					if (!r.load(i * 0x9e3779b97f4a7c15ull, loaded) || loaded != value)
+					{
+						return false;
+					}
+				}
+
+				return count == keys;
+			});
+
+			if (ok)
+			{
+				report(prefix + std::string("/reload") + suffix, keys, time, value.size() + 8);
+			}
+			else
+			{
+				std::fprintf(stderr, "%s/reload%s: loaded data mismatch\n", prefix, suffix.c_str());
+			}
+		}
+
+		std::remove(path.c_str());
+	}
+
+	void bench_ssdb()
+	{
+		for (std::size_t keys : {10000, 100000, 1000000, 10000000})
+		{
+			if (keys > 1000000 && !g_full)
+			{
+				break;
+			}
+
+			bench_umap<std::unordered_map>("ssdb/umap", keys);
+			bench_umap<ssdb::flat_map>("ssdb/umap_flat", keys);
+		}
+	}
+
+	template <typename M>
+	void bench_map_find(const char* name)
+	{
+		if (!enabled(name))
+		{
+			return;
+		}
+
+		constexpr std::size_t count = 1 << 20;
+
+		M map;
+		map.reserve(count);
+		std::vector<std::uint64_t> keys(count);
+		std::mt19937_64 rng(2);
+
+		for (auto& k : keys)
+		{
+			k = rng();
+			map.emplace(k, k);
+		}
+
+		run(name, 0, [&](std::uint64_t n)
+		{
+			std::size_t sum = 0;
+
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				sum += map.find(keys[(i * 7919) % count])->second;
+			}
+
+			g_sink = sum;
+		});
+	}
+
+	void bench_maps()
+	{
+		bench_map_find<std::unordered_map<std::uint64_t, std::uint64_t>>("map/unordered_map/find");
+		bench_map_find<ssdb::flat_map<std::uint64_t, std::uint64_t>>("map/flat_map/find");
+	}
+
+	void bench_sstl()
+	{
+		std::vector<std::uint32_t> vec(1 << 20);
+		std::iota(vec.begin(), vec.end(), 0u);
+
+		std::map<std::uint64_t, std::string> map;
+
+		for (std::uint64_t i = 0; i < 10000; i++)
+		{
+			map.emplace(i * 31, std::string(i % 100, 'x'));
+		}
+
+		std::vector<std::string> strs(10000, std::string(48, 's'));
+
+		const auto vec_ser = [&](auto ctx) { ctx(vec); };
+		const auto map_ser = [&](auto ctx) { ctx(map); };
+		const auto strs_ser = [&](auto ctx) { ctx(strs); };
+
+		const auto vec_bin = sstl::save(vec_ser);
+		const auto map_bin = sstl::save(map_ser);
+		const auto strs_bin = sstl::save(strs_ser);
+
+		run("sstl/save/vector_u32", vec_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = sstl::save(vec_ser).size();
+			}
+		});
+
+		run("sstl/load/vector_u32", vec_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				std::vector<std::uint32_t> out;
+				g_sink = sstl::load(vec_bin, [&](auto ctx) { ctx(out); });
+			}
+		});
+
+		run("sstl/save/map_u64_string", map_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = sstl::save(map_ser).size();
+			}
+		});
+
+		run("sstl/load/map_u64_string", map_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				std::map<std::uint64_t, std::string> out;
+				g_sink = sstl::load(map_bin, [&](auto ctx) { ctx(out); });
+			}
+		});
+
+		run("sstl/save/vector_string", strs_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = sstl::save(strs_ser).size();
+			}
+		});
+
+		run("sstl/load/vector_string", strs_bin.size(), [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				std::vector<std::string> out;
+				g_sink = sstl::load(strs_bin, [&](auto ctx) { ctx(out); });
+			}
+		});
+	}
+
+	void bench_crypto()
+	{
+		const auto priv = random_key();
+
+		to::pubkey pub;
+		pub.generate(priv.data());
+
+		// Cryptobox
+		constexpr std::size_t size = 1024;
+		std::vector<uchar> msg(size, 'm');
+		std::vector<uchar> box(size + 48);
+		pub.encrypt(msg.data(), size, box.data());
+
+		run("crypto/pubkey/encrypt/1024", size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = pub.encrypt(msg.data(), size, box.data());
+			}
+		});
+
+		run("crypto/pubkey/decrypt/1024", size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = to::pubkey::decrypt(msg.data(), size, priv.data(), box.data());
+			}
+		});
+
+		// Batches of 256 requests (ns_per_op is per request)
+		constexpr std::size_t batch = 256;
+		std::vector<uchar> boxes(batch * (size + 48));
+		std::vector<uchar> plain(batch * size);
+		std::vector<to::box_req> reqs(batch);
+
+		const auto make_reqs = [&](bool enc)
+		{
+			for (std::size_t i = 0; i < batch; i++)
+			{
+				reqs[i].key = &pub;
+				reqs[i].src = enc ? msg.data() : static_cast<const void*>(&boxes[i * (size + 48)]);
+				reqs[i].size = size;
+				reqs[i].dst = enc ? static_cast<void*>(&boxes[i * (size + 48)]) : &plain[i * size];
+			}
+		};
+
+		run("crypto/pubkey/encrypt_batch/1024", size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i += batch)
+			{
+				make_reqs(true);
+				g_sink = to::pubkey::encrypt(reqs.data(), std::min<std::uint64_t>(batch, n - i));
+			}
+		});
+
+		make_reqs(true);
+		to::pubkey::encrypt(reqs.data(), batch);
+
+		run("crypto/pubkey/decrypt_batch/1024", size, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i += batch)
+			{
+				make_reqs(false);
+				g_sink = to::pubkey::decrypt(reqs.data(), std::min<std::uint64_t>(batch, n - i), priv.data());
+			}
+		});
+
+		// Key operations
+		const auto peer = random_key();
+		uchar peer_pub[32];
+		uchar shared[32];
+		X25519_public_from_private(peer_pub, peer.data());
+
+		run("crypto/x25519", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = X25519(shared, priv.data(), peer_pub);
+			}
+		});
+
+		uchar ed_pub[32];
+		uchar sig[64];
+		ED25519_public_from_private(ed_pub, priv.data());
+		ED25519_sign(sig, msg.data(), 64, ed_pub, priv.data());
+
+		run("crypto/ed25519/sign", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = ED25519_sign(sig, msg.data(), 64, ed_pub, priv.data());
+			}
+		});
+
+		run("crypto/ed25519/verify", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				g_sink = ED25519_verify(msg.data(), 64, sig, ed_pub);
+			}
+		});
+
+		// Batch verification of 64 signatures (ns_per_op is per signature)
+		std::vector<const uint8_t*> msgs(64, msg.data());
+		std::vector<std::size_t> lens(64, 64);
+		std::vector<const uint8_t*> sigs(64, sig);
+		std::vector<const uint8_t*> keys(64, ed_pub);
+
+		run("crypto/ed25519/verify_batch/64", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i += 64)
+			{
+				g_sink = ED25519_verify_batch(msgs.data(), lens.data(), sigs.data(), keys.data(), std::min<std::uint64_t>(64, n - i), nullptr);
+			}
+		});
+
+		// Public key utilities
+		std::vector<to::pubkey> pubs(4096);
+		RAND_bytes(reinterpret_cast<uchar*>(pubs.data()), static_cast<int>(pubs.size() * sizeof(to::pubkey)));
+		std::vector<char> text(pubs.size() * to::pubkey::base57_size);
+
+		run("crypto/pubkey/std_hash", 0, [&](std::uint64_t n)
+		{
+			std::size_t sum = 0;
+
+			for (std::uint64_t i = 0; i < n; i++)
+			{
+				sum += pubs[i % pubs.size()].std_hash();
+			}
+
+			g_sink = sum;
+		});
+
+		{
+			std::vector<to::pubkey> keys(65536);
+			RAND_bytes(reinterpret_cast<uchar*>(keys.data()), static_cast<int>(keys.size() * sizeof(to::pubkey)));
+
+			std::unordered_map<to::pubkey, std::size_t> map;
+
+			for (std::size_t i = 0; i < keys.size(); i++)
+			{
+				map.emplace(keys[i], i);
+			}
+
+			run("crypto/pubkey/map_find/64k", 0, [&](std::uint64_t n)
+			{
+				std::size_t sum = 0;
+
+				for (std::uint64_t i = 0; i < n; i++)
+				{
+					sum += map.find(keys[i * 7919 % keys.size()])->second;
+				}
+
+				g_sink = sum;
+			});
+		}
+
+		run("crypto/pubkey/to_base57", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i += pubs.size())
+			{
+				to::pubkey::to_base57(pubs.data(), std::min<std::uint64_t>(pubs.size(), n - i), text.data());
+			}
+		});
+
+		run("crypto/pubkey/from_base57", 0, [&](std::uint64_t n)
+		{
+			for (std::uint64_t i = 0; i < n; i += pubs.size())
+			{
+				g_sink = to::pubkey::from_base57(pubs.data(), std::min<std::uint64_t>(pubs.size(), n - i), text.data());
+			}
+		});
+	}
+
+	// Wait until the condition is true (returns false on timeout)
+	template <typename F>
+	bool wait_for(F&& pred, double timeout = 30)
+	{
+		const auto start = clock_type::now();
+
+		while (!pred())
+		{
+			if (seconds(start) > timeout)
+			{
+				return false;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+
+		return true;
+	}
+
+	// Loopback connection through socket_engine: client sends (throughput) or ping-pongs 1 byte (latency)
+	void bench_socket()
+	{
+		const bool tput = enabled("socket/throughput");
+		const bool ping = enabled("socket/latency");
+
+		if (!tput && !ping)
+		{
+			return;
+		}
+
+		to::socket_engine engine(2);
+		to::server_thread server;
+
+		std::mutex mutex;
+		std::list<to::socket_thread> conns;
+
+		// Server mode: echo back or just count
+		std::atomic<bool> echo{false};
+		std::atomic<std::uint64_t> received{0};
+
+		server.start("127.0.0.1", g_port.c_str(), [&](int s, const char* addr, const char*)
+		{
+			if (!addr)
+			{
+				return true;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			conns.emplace_back();
+			auto* conn = &conns.back();
+			const bool mode = echo;
+
+			conn->start(engine, s, 0, addr, "", [&, conn, mode](to::cb_arg& arg)
+			{
+				if (arg == to::cb_arg::terminate)
+				{
+					return to::cb_res::terminate;
+				}
+
+				uchar buf[65536];
+
+				while (true)
+				{
+					const int r = to::recv(conn->get(), buf, sizeof(buf));
+
+					if (r < 0)
+					{
+						return to::cb_res::terminate;
+					}
+
+					if (r == 0)
+					{
+						break;
+					}
+
+					if (mode)
+					{
+						to::send(conn->get(), buf, r);
+					}
+
+					received += r;
+				}
+
+				return to::cb_res::wait_read;
+			});
+
+			return true;
+		});
+
+		const auto finish = [&](to::socket_thread& client)
+		{
+			client.terminate();
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (auto& c : conns)
+			{
+				c.terminate();
+			}
+
+			conns.clear();
+		};
+
+		if (tput)
+		{
+			constexpr std::uint64_t total = 256 << 20;
+			std::vector<uchar> chunk(65536, 'd');
+			std::uint64_t sent = 0;
+
+			echo = false;
+			received = 0;
+
+			to::socket_thread client;
+			const auto start = clock_type::now();
+
+			client.start(engine, "127.0.0.1", g_port.c_str(), [&](to::cb_arg& arg)
+			{
+				if (arg == to::cb_arg::terminate)
+				{
+					return to::cb_res::terminate;
+				}
+
+				while (sent < total)
+				{
+					const int r = to::send(client.get(), chunk.data(), static_cast<std::size_t>(std::min<std::uint64_t>(chunk.size(), total - sent)));
+
+					if (r < 0)
+					{
+						return to::cb_res::terminate;
+					}
+
+					if (r == 0)
+					{
+						return to::cb_res::wait_write;
+					}
+
+					sent += r;
+				}
+
+				return to::cb_res::wait_none;
+			});
+
+			if (wait_for([&] { return received == total; }))
+			{
+				report("socket/throughput", total / chunk.size(), seconds(start), chunk.size());
+			}
+			else
+			{
+				std::fprintf(stderr, "socket/throughput: timeout\n");
+			}
+
+			finish(client);
+		}
+
+		if (ping)
+		{
+			constexpr std::uint64_t rounds = 20000;
+			std::atomic<std::uint64_t> done{0};
+
+			echo = true;
+
+			to::socket_thread client;
+			auto start = clock_type::now();
+
+			client.start(engine, "127.0.0.1", g_port.c_str(), [&](to::cb_arg& arg)
+			{
+				if (arg == to::cb_arg::terminate)
+				{
+					return to::cb_res::terminate;
+				}
+
+				uchar buf[16];
+
+				if (done == 0)
+				{
+					// First call after connection
+					start = clock_type::now();
+					done = 1;
+					return to::send(client.get(), "p", 1) == 1 ? to::cb_res::wait_read : to::cb_res::terminate;
+				}
+
+				const int r = to::recv(client.get(), buf, sizeof(buf));
+
+				if (r < 0)
+				{
+					return to::cb_res::terminate;
+				}
+
+				if (r > 0 && done++ < rounds)
+				{
+					to::send(client.get(), "p", 1);
+				}
+
+				return to::cb_res::wait_read;
+			});
+
+			if (wait_for([&] { return done > rounds; }))
+			{
+				report("socket/latency", rounds, seconds(start));
+			}
+			else
+			{
+				std::fprintf(stderr, "socket/latency: timeout\n");
+			}
+
+			finish(client);
+		}
+
+		server.terminate();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+
+		if (arg == "--full")
+		{
+			g_full = true;
+		}
+		else if (arg == "--dir" && i + 1 < argc)
+		{
+			g_dir = argv[++i];
+		}
+		else if (arg == "--port" && i + 1 < argc)
+		{
+			g_port = argv[++i];
+		}
+		else
+		{
+			g_filters.emplace_back(arg);
+		}
+	}
+
+	bench_sfs();
+	bench_ssdb();
+	bench_maps();
+	bench_sstl();
+	bench_crypto();
+	bench_socket();
+	return 0;
+}
@@ -1,9 +1,12 @@
 ﻿#include "to_key.hpp"
 #include "util/sfs.hpp"
+#include "util/endian.hpp"
 #include <openssl/rand.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <cmath>
+#include <memory>
+#include <new>
 
 #ifdef _WIN32
 #define NOMINMAX
@@ -140,6 +143,7 @@ to::master_key::master_key(const std::string& key_path)
 
 to::master_key::~master_key()
 {
+	cancel();
 	reset();
 	HMAC_CTX_free(m_hmac);
 }
@@ -165,12 +169,10 @@ void to::master_key::reset()
 #endif
 }
 
-void to::master_key::init(const char* pass, std::size_t len)
+namespace
 {
-	reset();
-
 	// Fixed salt is usually insecure, however, it allows obtaining derived keys in a stateless manner.
-	static constexpr uchar static_salt[64] =
+	constexpr uchar s_static_salt[64] =
 	{
 		0x06, 0xCA, 0x7E, 0xA7, 0x42, 0x01, 0x65, 0xBB, 0xC1, 0xEF, 0xBB, 0x02, 0x21, 0x5B, 0x90, 0xCF,
 		0x2F, 0x45, 0x53, 0x90, 0x75, 0x2D, 0x1C, 0x21, 0x6F, 0x72, 0x36, 0xF4, 0xD4, 0x12, 0xE7, 0xFA,
@@ -178,10 +180,201 @@ void to::master_key::init(const char* pass, std::size_t len)
 		0x15, 0xB0, 0xAF, 0x6C, 0x35, 0x16, 0x53, 0x0A, 0xA8, 0x9B, 0x43, 0xFA, 0x86, 0xC5, 0xAA, 0xBE,
 	};
 
-	// Selected scrypt params use 512 MB of memory and should take about 1-2 sec of single-core load with a typical desktop CPU
-	while (EVP_PBE_scrypt(pass, len, static_salt, sizeof(static_salt), 512 * 1024, 8, 1, 600 * 1024 * 1024, m_secret, sizeof(m_secret)) == 0)
+	// Selected scrypt params (N = 512K, r = 8, p = 1) use 512 MB of memory and should take about 1-2 sec of single-core load with a typical desktop CPU
+	constexpr std::uint32_t s_scrypt_n = 512 * 1024;
+	constexpr std::size_t s_scrypt_r = 8;
+
+	// scrypt block size in 32-bit words (128 * r bytes)
+	constexpr std::size_t s_block = 32 * s_scrypt_r;
+
+	// Max memory saving factor (only every n-th block is stored and others are recomputed)
+	constexpr std::uint32_t s_max_tmto = 32;
+
+	// Iterations between cancellation checks and progress reports
+	constexpr std::uint32_t s_report_step = 1024;
+
+	inline std::uint32_t rotl(std::uint32_t x, int n)
+	{
+		return (x << n) | (x >> (32 - n));
+	}
+
+	void salsa20_8(std::uint32_t b[16])
+	{
+		std::uint32_t x[16];
+		std::memcpy(x, b, sizeof(x));
+
+		for (int i = 0; i < 8; i += 2)
+		{
+			// Columns
+			x[4] ^= rotl(x[0] + x[12], 7), x[8] ^= rotl(x[4] + x[0], 9), x[12] ^= rotl(x[8] + x[4], 13), x[0] ^= rotl(x[12] + x[8], 18);
+			x[9] ^= rotl(x[5] + x[1], 7), x[13] ^= rotl(x[9] + x[5], 9), x[1] ^= rotl(x[13] + x[9], 13), x[5] ^= rotl(x[1] + x[13], 18);
+			x[14] ^= rotl(x[10] + x[6], 7), x[2] ^= rotl(x[14] + x[10], 9), x[6] ^= rotl(x[2] + x[14], 13), x[10] ^= rotl(x[6] + x[2], 18);
+			x[3] ^= rotl(x[15] + x[11], 7), x[7] ^= rotl(x[3] + x[15], 9), x[11] ^= rotl(x[7] + x[3], 13), x[15] ^= rotl(x[11] + x[7], 18);
+
+			// Rows
+			x[1] ^= rotl(x[0] + x[3], 7), x[2] ^= rotl(x[1] + x[0], 9), x[3] ^= rotl(x[2] + x[1], 13), x[0] ^= rotl(x[3] + x[2], 18);
+			x[6] ^= rotl(x[5] + x[4], 7), x[7] ^= rotl(x[6] + x[5], 9), x[4] ^= rotl(x[7] + x[6], 13), x[5] ^= rotl(x[4] + x[7], 18);
+			x[11] ^= rotl(x[10] + x[9], 7), x[8] ^= rotl(x[11] + x[10], 9), x[9] ^= rotl(x[8] + x[11], 13), x[10] ^= rotl(x[9] + x[8], 18);
+			x[12] ^= rotl(x[15] + x[14], 7), x[13] ^= rotl(x[12] + x[15], 9), x[14] ^= rotl(x[13] + x[12], 13), x[15] ^= rotl(x[14] + x[13], 18);
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			b[i] += x[i];
+		}
+	}
+
+	// scrypt BlockMix (in -> out, buffers must not overlap)
+	void block_mix(const std::uint32_t* in, std::uint32_t* out)
+	{
+		std::uint32_t x[16];
+		std::memcpy(x, in + s_block - 16, sizeof(x));
+
+		for (std::size_t i = 0; i < 2 * s_scrypt_r; i++)
+		{
+			for (std::size_t j = 0; j < 16; j++)
+			{
+				x[j] ^= in[i * 16 + j];
+			}
+
+			salsa20_8(x);
+
+			// Even blocks go to the first half, odd blocks to the second half
+			std::memcpy(out + (i / 2 + (i % 2) * s_scrypt_r) * 16, x, sizeof(x));
+		}
+	}
+
+	// scrypt (p = 1) with cancellation, progress and reduced memory usage on allocation failure
+	bool derive_secret(const char* pass, std::size_t len, uchar* out, std::size_t out_size, const std::atomic<bool>* cancel, const std::function<void(const to::kdf_progress&)>& progress)
 	{
-		if (!gui_warn("Out of memory. This operation requires 512 MiB of free memory."))
+		// Find affordable memory saving factor
+		std::unique_ptr<std::uint32_t[]> v;
+		std::uint32_t tmto = 1;
+
+		for (; tmto <= s_max_tmto; tmto *= 2)
+		{
+			v.reset(new (std::nothrow) std::uint32_t[std::size_t{s_scrypt_n / tmto} * s_block]);
+
+			if (v)
+			{
+				break;
+			}
+		}
+
+		if (!v)
+		{
+			return false;
+		}
+
+		to::kdf_progress info{0, std::uint64_t{s_scrypt_n} * 2, std::size_t{s_scrypt_n / tmto} * s_block * 4};
+
+		uchar b[s_block * 4];
+		std::uint32_t x[s_block];
+		std::uint32_t t[s_block];
+
+		if (PKCS5_PBKDF2_HMAC(pass, static_cast<int>(len), s_static_salt, sizeof(s_static_salt), 1, EVP_sha256(), sizeof(b), b) != 1)
+		{
+			return false;
+		}
+
+		for (std::size_t i = 0; i < s_block; i++)
+		{
+			std::le_load(x[i], b + i * 4);
+		}
+
+		// Returns false if cancelled
+		const auto report = [&](std::uint64_t done)
+		{
+			info.done = done;
+
+			if (progress)
+			{
+				progress(info);
+			}
+
+			return !cancel || !cancel->load();
+		};
+
+		bool ok = true;
+
+		// Fill V (the last iteration leaves the result in x)
+		for (std::uint32_t i = 0; ok && i < s_scrypt_n; i++)
+		{
+			if (i % tmto == 0)
+			{
+				std::memcpy(&v[std::size_t{i / tmto} * s_block], x, sizeof(x));
+			}
+
+			block_mix(x, t);
+			std::memcpy(x, t, sizeof(x));
+
+			if ((i + 1) % s_report_step == 0)
+			{
+				ok = report(i + 1);
+			}
+		}
+
+		for (std::uint32_t i = 0; ok && i < s_scrypt_n; i++)
+		{
+			// Integerify (N is a power of 2 not exceeding 2^32)
+			const std::uint32_t j = x[s_block - 16] & (s_scrypt_n - 1);
+
+			if (j % tmto == 0)
+			{
+				for (std::size_t k = 0; k < s_block; k++)
+				{
+					x[k] ^= v[std::size_t{j / tmto} * s_block + k];
+				}
+			}
+			else
+			{
+				// Recompute V[j] from the nearest stored block
+				std::uint32_t y[s_block];
+				std::memcpy(t, &v[std::size_t{j / tmto} * s_block], sizeof(t));
+
+				for (std::uint32_t k = 0; k < j % tmto; k++)
+				{
+					block_mix(t, y);
+					std::memcpy(t, y, sizeof(t));
+				}
+
+				for (std::size_t k = 0; k < s_block; k++)
+				{
+					x[k] ^= t[k];
+				}
+			}
+
+			block_mix(x, t);
+			std::memcpy(x, t, sizeof(x));
+
+			if ((i + 1) % s_report_step == 0)
+			{
+				ok = report(std::uint64_t{s_scrypt_n} + i + 1);
+			}
+		}
+
+		for (std::size_t i = 0; i < s_block; i++)
+		{
+			std::le_store(b + i * 4, x[i]);
+		}
+
+		ok = ok && PKCS5_PBKDF2_HMAC(pass, static_cast<int>(len), b, sizeof(b), 1, EVP_sha256(), static_cast<int>(out_size), out) == 1;
+
+		OPENSSL_cleanse(b, sizeof(b));
+		OPENSSL_cleanse(x, sizeof(x));
+		OPENSSL_cleanse(t, sizeof(t));
+		OPENSSL_cleanse(v.get(), std::size_t{s_scrypt_n / tmto} * s_block * 4);
+		return ok;
+	}
+}
+
+void to::master_key::init(const char* pass, std::size_t len)
+{
+	reset();
+
+	while (!derive_secret(pass, len, m_secret, sizeof(m_secret), nullptr, nullptr))
+	{
+		if (!gui_warn("Out of memory. This operation requires at least 16 MiB of free memory."))
 		{
 			std::terminate();
 		}
@@ -191,6 +384,43 @@ void to::master_key::init(const char* pass, std::size_t len)
 	set_pass(pass, len);
 }
 
+std::future<bool> to::master_key::init_async(const char* pass, std::size_t len, std::function<void(const kdf_progress&)> progress)
+{
+	cancel();
+	reset();
+
+	// Keep a copy of the password for the worker thread
+	set_pass(pass, len);
+	m_cancel = false;
+
+	std::promise<bool> promise;
+	auto result = promise.get_future();
+
+	m_worker = std::thread([this, promise = std::move(promise), progress = std::move(progress)]() mutable
+	{
+		if (!derive_secret(m_pass, m_pass_size, m_secret, sizeof(m_secret), &m_cancel, progress))
+		{
+			reset();
+			promise.set_value(false);
+			return;
+		}
+
+		init(m_secret, sizeof(m_secret));
+		promise.set_value(true);
+	});
+
+	return result;
+}
+
+void to::master_key::cancel()
+{
+	if (m_worker.joinable())
+	{
+		m_cancel = true;
+		m_worker.join();
+	}
+}
+
 void to::master_key::init(const uchar* secret, std::size_t size)
 {
 	if (!secret || !size || HMAC_Init_ex(m_hmac, secret, static_cast<int>(size), EVP_sha512(), nullptr) != 1)
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <string>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <functional>
+#include <cstdint>
 #include "util/sfs.hpp"
 
 extern "C"
@@ -12,6 +17,17 @@ using uchar = unsigned char;
 
 namespace to
 {
+	// Key derivation progress (reported from the worker thread)
+	struct kdf_progress
+	{
+		// Completed and total scrypt iterations
+		std::uint64_t done;
+		std::uint64_t total;
+
+		// Memory used (reduced if 512 MiB can't be allocated, at the cost of more computation)
+		std::size_t memory;
+	};
+
 	class master_key final
 	{
 		// HMAC context (SHA-512)
@@ -38,6 +54,12 @@ namespace to
 		// Key generated from the password (key file contents)
 		uchar m_secret[128]{};
 
+		// Worker thread for init_async()
+		std::thread m_worker;
+
+		// Cancellation flag for init_async()
+		std::atomic<bool> m_cancel{false};
+
 	public:
 		// Total number of dictionaries
 		static std::size_t dict_count();
@@ -62,6 +84,13 @@ namespace to
 
 		void init(const char* pass, std::size_t len);
 
+		// Run init(pass, len) on a dedicated thread, result is false if cancelled or out of memory.
+		// The object must not be used until the result is ready (except for cancel()).
+		std::future<bool> init_async(const char* pass, std::size_t len, std::function<void(const kdf_progress&)> progress = nullptr);
+
+		// Cancel init_async() and wait for the worker thread
+		void cancel();
+
 		const uchar* get(const char* info, std::size_t info_size = -1);
 
 		void generate(const std::string& prefix, std::size_t dict_id, int len);
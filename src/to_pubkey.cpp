@@ -5,6 +5,15 @@
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 #include "util/curve25519.hpp"
+#include "util/sfs.hpp"
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // Base57 uses: numbers, latin uppercase without 'B', 'D', 'I', 'O', latin lowercase without 'l'
 constexpr char s_base57_palette[] = "0123456789ACEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
@@ -40,6 +49,94 @@ static constexpr uchar base57_lut[256] =
 #undef XP4
 #undef XP5
 
+// Base57 is processed in 11-digit groups (64-bit blocks) of 1 + 5 + 5 digits, 5 digits fit in 32 bits
+static constexpr std::uint64_t s_base57_e5 = 57ull * 57 * 57 * 57 * 57;
+static constexpr std::uint64_t s_base57_e10 = s_base57_e5 * s_base57_e5;
+
+// Two-digit table (57 * 57 character pairs)
+struct base57_pairs
+{
+	char data[57 * 57][2];
+
+	constexpr base57_pairs()
+		: data{}
+	{
+		for (std::size_t i = 0; i < 57 * 57; i++)
+		{
+			data[i][0] = s_base57_palette[i / 57];
+			data[i][1] = s_base57_palette[i % 57];
+		}
+	}
+};
+
+static constexpr base57_pairs s_base57_pairs{};
+
+static inline void base57_encode5(std::uint32_t value, char* out)
+{
+	std::memcpy(out + 3, s_base57_pairs.data[value % (57 * 57)], 2);
+	value /= 57 * 57;
+	std::memcpy(out + 1, s_base57_pairs.data[value % (57 * 57)], 2);
+	out[0] = s_base57_palette[value / (57 * 57)];
+}
+
+// Encode 64-bit value as 11 characters (only two 64-bit divisions by constant)
+static inline void base57_encode(std::uint64_t value, char* out)
+{
+	const std::uint64_t low = value % s_base57_e10;
+
+	out[0] = s_base57_palette[value / s_base57_e10];
+	base57_encode5(static_cast<std::uint32_t>(low / s_base57_e5), out + 1);
+	base57_encode5(static_cast<std::uint32_t>(low % s_base57_e5), out + 6);
+}
+
+// Accumulate max digit to validate all characters at once (57 for invalid characters)
+static inline std::uint32_t base57_decode5(const char* in, uchar& max)
+{
+	std::uint32_t value = 0;
+
+	for (int j = 0; j < 5; j++)
+	{
+		const uchar digit = base57_lut[static_cast<uchar>(in[j])];
+		max = std::max(max, digit);
+		value = value * 57 + digit;
+	}
+
+	return value;
+}
+
+// Decode 11 characters (wraps around on overflow as the digit-by-digit method)
+static inline std::uint64_t base57_decode(const char* in, uchar& max)
+{
+	const uchar digit = base57_lut[static_cast<uchar>(in[0])];
+	max = std::max(max, digit);
+	return digit * s_base57_e10 + base57_decode5(in + 1, max) * s_base57_e5 + base57_decode5(in + 6, max);
+}
+
+// Decode 32-byte key from 44 characters, returns false on invalid characters (out is not modified)
+static inline bool base57_decode_key(const char* in, uchar* out)
+{
+	std::uint64_t value[4];
+	uchar max = 0;
+
+	for (std::size_t i = 0; i < 4; i++)
+	{
+		value[i] = base57_decode(in + i * 11, max);
+	}
+
+	if (max >= 57)
+	{
+		return false;
+	}
+
+	for (std::size_t i = 0; i < 4; i++)
+	{
+		// Store big endian 64-bit value
+		std::be_store(out + i * 8, value[i]);
+	}
+
+	return true;
+}
+
 std::string to::pubkey::hex() const
 {
 	static constexpr char s_hex_palette[] = "0123456789abcdef";
@@ -69,14 +166,7 @@ std::string to::pubkey::base57() const
 	for (std::size_t i = 0, p = 0; i < sizeof(m_key); i += 8, p += 11)
 	{
 		// Load block as a big endian 64-bit value
-		std::uint64_t value;
-		std::be_load(value, m_key + i);
-
-		for (int j = 10; j >= 0; j--)
-		{
-			ptr[p + j] = s_base57_palette[value % 57];
-			value /= 57;
-		}
+		base57_encode(std::be_load<std::uint64_t>(m_key + i), ptr + p);
 	}
 
 	return result;
@@ -87,7 +177,7 @@ bool to::pubkey::base57(const char* ptr)
 	// Base57 encoding: each 64-bit block corresponds to 11 Base57 characters
 	static_assert(sizeof(m_key) % 8 == 0, "Unexpected key size (not multiple of 64 bit)");
 
-	// Validate characters
+	// Validate characters (stop at null terminator before reading further)
 	for (std::size_t i = 0; i < sizeof(m_key) / 8 * 11; i++)
 	{
 		if (base57_lut[static_cast<uchar>(ptr[i])] >= 57)
@@ -96,21 +186,94 @@ bool to::pubkey::base57(const char* ptr)
 		}
 	}
 
-	for (std::size_t i = 0, p = 0; i < sizeof(m_key); i += 8, p += 11)
+	return base57_decode_key(ptr, m_key);
+}
+
+void to::pubkey::to_base57(const pubkey* keys, std::size_t count, char* out)
+{
+	for (std::size_t k = 0; k < count; k++, out += base57_size)
 	{
-		std::uint64_t value = 0;
+		for (std::size_t i = 0, p = 0; i < sizeof(m_key); i += 8, p += 11)
+		{
+			base57_encode(std::be_load<std::uint64_t>(keys[k].m_key + i), out + p);
+		}
+	}
+}
 
-		for (int j = 0; j < 11; j++)
+std::size_t to::pubkey::from_base57(pubkey* keys, std::size_t count, const char* in)
+{
+	for (std::size_t k = 0; k < count; k++, in += base57_size)
+	{
+		if (!base57_decode_key(in, keys[k].m_key))
 		{
-			value *= 57;
-			value += base57_lut[static_cast<uchar>(ptr[p + j])];
+			return k;
 		}
+	}
 
-		// Store big endian 64-bit value
-		std::be_store(m_key + i, value);
+	return count;
+}
+
+namespace
+{
+	// Random secrets for pubkey hashing
+	struct hash_key
+	{
+		std::uint64_t k[6];
+
+		hash_key()
+		{
+			if (RAND_bytes(reinterpret_cast<uchar*>(k), sizeof(k)) != 1)
+			{
+				std::random_device rd;
+
+				for (auto& v : k)
+				{
+					v = std::uint64_t{rd()} << 32 | rd();
+				}
+			}
+		}
+	};
+
+	const hash_key& get_hash_key()
+	{
+		static const hash_key s_key;
+		return s_key;
 	}
 
-	return true;
+	// Fold 128-bit product
+	inline std::uint64_t fold_mul(std::uint64_t a, std::uint64_t b)
+	{
+#if defined(__SIZEOF_INT128__)
+		const unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+		return static_cast<std::uint64_t>(r >> 64) ^ static_cast<std::uint64_t>(r);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		std::uint64_t hi;
+		const std::uint64_t lo = _umul128(a, b, &hi);
+		return hi ^ lo;
+#else
+		// Four 32-bit partial products
+		const std::uint64_t ll = (a & 0xffffffff) * (b & 0xffffffff);
+		const std::uint64_t lh = (a & 0xffffffff) * (b >> 32);
+		const std::uint64_t hl = (a >> 32) * (b & 0xffffffff);
+		const std::uint64_t hh = (a >> 32) * (b >> 32);
+		const std::uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+		const std::uint64_t lo = mid << 32 | (ll & 0xffffffff);
+		const std::uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+		return hi ^ lo;
+#endif
+	}
+}
+
+std::size_t to::pubkey::std_hash() const
+{
+	// Key words are mixed with secrets by folded multiplications. Peers can send any 32 bytes
+	// and grind keys, only the secrets protect against flooding: buckets can't be predicted without them.
+	const std::uint64_t* k = get_hash_key().k;
+
+	const std::uint64_t a = fold_mul(std::le_load<std::uint64_t>(m_key + 0) ^ k[0], std::le_load<std::uint64_t>(m_key + 8) ^ k[1]);
+	const std::uint64_t b = fold_mul(std::le_load<std::uint64_t>(m_key + 16) ^ k[2], std::le_load<std::uint64_t>(m_key + 24) ^ k[3]);
+
+	return static_cast<std::size_t>(fold_mul(a ^ k[4], b ^ k[5]));
 }
 
 void to::pubkey::generate(const uchar* priv_key)
@@ -133,89 +296,310 @@ bool to::pubkey::secret(const uchar* priv_key, uchar* out_sha512) const
 	return true;
 }
 
+namespace
+{
+	// Min number of cryptoboxes processed by a single thread in a parallel batch
+	constexpr std::size_t s_min_chunk = 8;
+
+	// Number of ephemeral keys generated at once
+	constexpr std::size_t s_rand_batch = 64;
+
+	// Nonce (all zeros, every derived key is used once)
+	const uchar s_nonce[12]{};
+
+	// Get thread-local AES-256-GCM context (reused between cryptoboxes, only the key is changed)
+	EVP_CIPHER_CTX* get_ctx(bool enc)
+	{
+		struct holder
+		{
+			EVP_CIPHER_CTX* ctx[2]{};
+
+			~holder()
+			{
+				EVP_CIPHER_CTX_free(ctx[0]);
+				EVP_CIPHER_CTX_free(ctx[1]);
+			}
+		};
+
+		static thread_local holder s_holder;
+
+		EVP_CIPHER_CTX*& ctx = s_holder.ctx[enc];
+
+		if (!ctx && (ctx = EVP_CIPHER_CTX_new()))
+		{
+			if ((enc ? EVP_EncryptInit_ex : EVP_DecryptInit_ex)(ctx, EVP_aes_256_gcm(), nullptr, nullptr, nullptr) != 1)
+			{
+				EVP_CIPHER_CTX_free(ctx);
+				ctx = nullptr;
+			}
+		}
+
+		return ctx;
+	}
+
+	// Encrypt with ephemeral private key
+	bool seal(EVP_CIPHER_CTX* ctx, const uchar* priv_key, const uchar* pub_key, const void* buf, std::size_t size, uchar* out_cryptobox)
+	{
+		uchar enc_key[64];
+		uchar shared_key[32];
+
+		// Compute static-ephemeral shared secret hash it with SHA-512
+		bool ok = ctx != nullptr &&
+			size <= 0x10000000 &&
+			X25519(shared_key, priv_key, pub_key) == 1 &&
+			SHA512(shared_key, sizeof(shared_key), enc_key) != nullptr;
+
+		if (ok)
+		{
+			// Write ephemeral public key
+			X25519_public_from_private(out_cryptobox + 0, priv_key);
+
+			// Initialize derived encryption key, nonce (all zeros), use ephemeral public key as AAD
+			int len;
+
+			ok = EVP_EncryptInit_ex(ctx, nullptr, nullptr, enc_key, s_nonce) == 1 &&
+				EVP_EncryptUpdate(ctx, nullptr, &len, out_cryptobox, 32) == 1 &&
+				EVP_EncryptUpdate(ctx, out_cryptobox + 32, &len, static_cast<const uchar*>(buf), static_cast<int>(size)) == 1 &&
+				EVP_EncryptFinal_ex(ctx, out_cryptobox + 32 + len, &len) == 1 &&
+				EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, out_cryptobox + 32 + size) == 1;
+		}
+
+		OPENSSL_cleanse(enc_key, sizeof(enc_key));
+		OPENSSL_cleanse(shared_key, sizeof(shared_key));
+		return ok;
+	}
+
+	bool open(EVP_CIPHER_CTX* ctx, const uchar* priv_key, const uchar* cryptobox, std::size_t size, void* buf)
+	{
+		uchar enc_key[64];
+
+		if (!ctx || size > 0x10000000 || !reinterpret_cast<const to::pubkey*>(cryptobox)->secret(priv_key, enc_key))
+		{
+			return false;
+		}
+
+		// Initialize derived encryption key, nonce (all zeros), use ephemeral public key as AAD
+		int len;
+
+		const bool ok = EVP_DecryptInit_ex(ctx, nullptr, nullptr, enc_key, s_nonce) == 1 &&
+			EVP_DecryptUpdate(ctx, nullptr, &len, cryptobox, 32) == 1 &&
+			EVP_DecryptUpdate(ctx, static_cast<uchar*>(buf), &len, cryptobox + 32, static_cast<int>(size)) == 1 &&
+			EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, const_cast<uchar*>(cryptobox) + 32 + size) == 1 &&
+			EVP_DecryptFinal_ex(ctx, static_cast<uchar*>(buf) + len, &len) > 0;
+
+		OPENSSL_cleanse(enc_key, sizeof(enc_key));
+		return ok;
+	}
+
+	// Process requests in contiguous ranges on shared threads
+	std::size_t run_batch(std::size_t count, const std::function<std::size_t(std::size_t, std::size_t)>& func)
+	{
+		const std::size_t chunks = std::max<std::size_t>(std::min(sfs::parallelism(), count / s_min_chunk), 1);
+
+		if (chunks == 1)
+		{
+			return func(0, count);
+		}
+
+		std::atomic<std::size_t> result{0};
+
+		sfs::run_parallel(chunks, [&](std::size_t k)
+		{
+			result += func(count * k / chunks, count * (k + 1) / chunks);
+		});
+
+		return result;
+	}
+}
+
 bool to::pubkey::encrypt(const void* buf, std::size_t size, uchar* out_cryptobox) const
 {
-	uchar enc_key[64];
 	uchar priv_key[32];
-	uchar shared_key[32];
 
-	// Arbitrary size limit
-	if (size > 0x10000000)
+	// Generate random ephemeral private key
+	const bool ok = RAND_bytes(priv_key, sizeof(priv_key)) == 1 &&
+		seal(get_ctx(true), priv_key, m_key, buf, size, out_cryptobox);
+
+	OPENSSL_cleanse(priv_key, sizeof(priv_key));
+	return ok;
+}
+
+bool to::pubkey::decrypt(void* buf, std::size_t size, const uchar* priv_key, const uchar* cryptobox)
+{
+	return open(get_ctx(false), priv_key, cryptobox, size, buf);
+}
+
+std::size_t to::pubkey::encrypt(box_req* reqs, std::size_t count)
+{
+	return run_batch(count, [reqs](std::size_t begin, std::size_t end)
 	{
-		return false;
+		EVP_CIPHER_CTX* const ctx = get_ctx(true);
+
+		// Ephemeral private keys are generated in groups
+		uchar priv_keys[s_rand_batch * 32];
+		bool rand_ok = false;
+		std::size_t result = 0;
+
+		for (std::size_t i = begin; i < end; i++)
+		{
+			const std::size_t pos = (i - begin) % s_rand_batch;
+
+			if (pos == 0)
+			{
+				rand_ok = RAND_bytes(priv_keys, static_cast<int>(std::min(end - i, s_rand_batch) * 32)) == 1;
+			}
+
+			box_req& req = reqs[i];
+			req.result = rand_ok && seal(ctx, priv_keys + pos * 32, req.key->m_key, req.src, req.size, static_cast<uchar*>(req.dst));
+			result += req.result;
+		}
+
+		OPENSSL_cleanse(priv_keys, sizeof(priv_keys));
+		return result;
+	});
+}
+
+std::size_t to::pubkey::decrypt(box_req* reqs, std::size_t count, const uchar* priv_key)
+{
+	return run_batch(count, [reqs, priv_key](std::size_t begin, std::size_t end)
+	{
+		EVP_CIPHER_CTX* const ctx = get_ctx(false);
+
+		std::size_t result = 0;
+
+		for (std::size_t i = begin; i < end; i++)
+		{
+			box_req& req = reqs[i];
+			req.result = open(ctx, priv_key, static_cast<const uchar*>(req.src), req.size, req.dst);
+			result += req.result;
+		}
+
+		return result;
+	});
+}
+
+namespace
+{
+	std::uint64_t get_time_ms()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 	}
+}
+
+to::secret_cache::secret_cache(const uchar* priv_key, std::size_t capacity, std::uint64_t ttl_ms)
+	: m_capacity(std::max<std::size_t>(capacity, 1))
+	, m_ttl(ttl_ms)
+{
+	std::memcpy(m_priv, priv_key, sizeof(m_priv));
+}
 
-	// Generate random ephemeral private key, compute static-ephemeral shared secret hash it with SHA-512
-	if (RAND_bytes(priv_key, sizeof(priv_key)) != 1 ||
-		X25519(shared_key, priv_key, m_key) != 1 ||
-		SHA512(shared_key, sizeof(shared_key), enc_key) == nullptr)
+to::secret_cache::~secret_cache()
+{
+	clear();
+	OPENSSL_cleanse(m_priv, sizeof(m_priv));
+}
+
+void to::secret_cache::remove(std::list<entry>::iterator it)
+{
+	OPENSSL_cleanse(it->secret, sizeof(it->secret));
+	m_map.erase(it->peer);
+	m_list.erase(it);
+}
+
+bool to::secret_cache::secret(const pubkey& peer, uchar* out_sha512)
+{
 	{
-		return false;
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		const auto found = m_map.find(peer);
+
+		if (found != m_map.end())
+		{
+			if (!m_ttl || found->second->expire > get_time_ms())
+			{
+				// Move to front
+				m_list.splice(m_list.begin(), m_list, found->second);
+				std::memcpy(out_sha512, found->second->secret, 64);
+				m_hits++;
+				return true;
+			}
+
+			remove(found->second);
+		}
 	}
 
-	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+	m_misses++;
 
-	if (!ctx)
+	// Compute without holding the lock
+	if (!peer.secret(m_priv, out_sha512))
 	{
 		return false;
 	}
 
-	// Write ephemeral public key
-	X25519_public_from_private(out_cryptobox + 0, priv_key);
+	std::lock_guard<std::mutex> lock(m_mutex);
 
-	// Initialize derived encryption key, nonce (all zeros), use ephemeral public key as AAD
-	static uchar nonce[12] = {0};
-	int len;
+	if (m_map.count(peer))
+	{
+		// Added concurrently
+		return true;
+	}
 
-	if (EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, enc_key, nonce) != 1 ||
-		EVP_EncryptUpdate(ctx, nullptr, &len, out_cryptobox, 32) != 1 ||
-		EVP_EncryptUpdate(ctx, out_cryptobox + 32, &len, reinterpret_cast<const uchar*>(buf), static_cast<int>(size)) != 1 ||
-		EVP_EncryptFinal_ex(ctx, out_cryptobox + 32 + len, &len) != 1 ||
-		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, out_cryptobox + 32 + size) != 1)
+	if (m_map.size() >= m_capacity)
 	{
-		EVP_CIPHER_CTX_free(ctx);
-		return false;
+		remove(std::prev(m_list.end()));
 	}
 
-	OPENSSL_cleanse(enc_key, sizeof(enc_key));
-	OPENSSL_cleanse(priv_key, sizeof(priv_key));
-	OPENSSL_cleanse(shared_key, sizeof(shared_key));
-	EVP_CIPHER_CTX_free(ctx);
+	m_list.emplace_front();
+	entry& e = m_list.front();
+	e.peer = peer;
+	std::memcpy(e.secret, out_sha512, 64);
+	e.expire = m_ttl ? get_time_ms() + m_ttl : 0;
+	m_map.emplace(peer, m_list.begin());
 	return true;
 }
 
-bool to::pubkey::decrypt(void* buf, std::size_t size, const uchar* priv_key, const uchar* cryptobox)
+void to::secret_cache::erase(const pubkey& peer)
 {
-	uchar enc_key[64];
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const auto found = m_map.find(peer);
 
-	if (size > 0x10000000 || !reinterpret_cast<const to::pubkey*>(cryptobox)->secret(priv_key, enc_key))
+	if (found != m_map.end())
 	{
-		return false;
+		remove(found->second);
 	}
+}
 
-	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+void to::secret_cache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
 
-	if (!ctx)
+	while (!m_list.empty())
 	{
-		return false;
+		remove(m_list.begin());
 	}
+}
 
-	// Initialize derived encryption key, nonce (all zeros), use ephemeral public key as AAD
-	static uchar nonce[12] = {0};
-	int len;
-
-	if (EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, enc_key, nonce) != 1 ||
-		EVP_DecryptUpdate(ctx, nullptr, &len, cryptobox, 32) != 1 ||
-		EVP_DecryptUpdate(ctx, reinterpret_cast<uchar*>(buf), &len, cryptobox + 32, static_cast<int>(size)) != 1 ||
-		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, const_cast<uchar*>(cryptobox) + 32 + size) != 1 ||
-		EVP_DecryptFinal_ex(ctx, reinterpret_cast<uchar*>(buf) + len, &len) <= 0)
+void to::secret_cache::expire()
+{
+	if (!m_ttl)
 	{
-		OPENSSL_cleanse(enc_key, sizeof(enc_key));
-		EVP_CIPHER_CTX_free(ctx);
-		return false;
+		return;
 	}
 
-	OPENSSL_cleanse(enc_key, sizeof(enc_key));
-	EVP_CIPHER_CTX_free(ctx);
-	return true;
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const std::uint64_t now = get_time_ms();
+
+	for (auto it = m_list.begin(); it != m_list.end();)
+	{
+		if (it->expire <= now)
+		{
+			remove(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
 }
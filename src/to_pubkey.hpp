@@ -4,11 +4,36 @@
 #include <cstdint>
 #include <cstring>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <unordered_map>
 
 using uchar = unsigned char;
 
 namespace to
 {
+	class pubkey;
+
+	// Cryptobox request for batch operations
+	struct box_req
+	{
+		// Recipient public key (only used by encryption)
+		const pubkey* key;
+
+		// Input buffer (plaintext or cryptobox)
+		const void* src;
+
+		// Plaintext size (cryptobox size = size + 32 + 16)
+		std::size_t size;
+
+		// Output buffer (cryptobox or plaintext)
+		void* dst;
+
+		// Operation result
+		bool result;
+	};
+
 	// X25519 public key
 	class pubkey
 	{
@@ -18,11 +43,8 @@ namespace to
 	public:
 		pubkey() = default;
 
-		// TODO: randomize the method of getting the hash
-		std::size_t std_hash() const
-		{
-			return reinterpret_cast<const std::size_t&>(m_key);
-		}
+		// Keyed hash (random per-process secrets): peers may send arbitrary keys, but can't craft colliding ones
+		std::size_t std_hash() const;
 
 		// Convert to Hex (lowercase)
 		std::string hex() const;
@@ -33,6 +55,15 @@ namespace to
 		// Set public key from Base57
 		bool base57(const char* ptr);
 
+		// Base57 string length
+		static constexpr std::size_t base57_size = 44;
+
+		// Convert many keys to Base57 (base57_size characters per key, no separators or terminator)
+		static void to_base57(const pubkey* keys, std::size_t count, char* out);
+
+		// Set many keys from Base57 (returns number of keys set before the first invalid one)
+		static std::size_t from_base57(pubkey* keys, std::size_t count, const char* in);
+
 		// Set public key from private key
 		void generate(const uchar* priv_key);
 
@@ -65,10 +96,28 @@ namespace to
 		// Decrypt anonymous cryptobox (cryptobox size = size + 32 + 16, AES-256-GCM)
 		static bool decrypt(void* buf, std::size_t size, const uchar* priv_key, const uchar* cryptobox);
 
+		// Encrypt cryptoboxes for many recipients, large batches are split between threads (returns number of successful requests)
+		static std::size_t encrypt(box_req* reqs, std::size_t count);
+
+		// Decrypt many cryptoboxes with the same private key (same as above)
+		static std::size_t decrypt(box_req* reqs, std::size_t count, const uchar* priv_key);
+
 		using serialize_copy = void;
 	};
 }
 
+namespace to
+{
+	// Hash function for containers keyed by to::pubkey (such as ssdb::umap)
+	struct pubkey_hash
+	{
+		std::size_t operator()(const to::pubkey& key) const
+		{
+			return key.std_hash();
+		}
+	};
+}
+
 namespace std
 {
 	template <>
@@ -80,3 +129,77 @@ namespace std
 		}
 	};
 }
+
+namespace to
+{
+	// Bounded thread-safe cache of shared secrets (pubkey::secret results) for one private key.
+	// Least recently used entries are evicted, secrets are wiped on eviction, expiration and destruction.
+	class secret_cache final
+	{
+		struct entry
+		{
+			pubkey peer;
+
+			uchar secret[64];
+
+			// Expiration time (steady clock, ms)
+			std::uint64_t expire;
+		};
+
+		mutable std::mutex m_mutex;
+
+		// Private key copy
+		uchar m_priv[32];
+
+		// Entries in LRU order (most recent first)
+		std::list<entry> m_list;
+
+		std::unordered_map<pubkey, std::list<entry>::iterator> m_map;
+
+		std::size_t m_capacity;
+
+		// Time to live in ms (0 = unlimited)
+		std::uint64_t m_ttl;
+
+		std::atomic<std::uint64_t> m_hits{0};
+		std::atomic<std::uint64_t> m_misses{0};
+
+		// Wipe and remove entry (must be locked)
+		void remove(std::list<entry>::iterator it);
+
+	public:
+		secret_cache(const uchar* priv_key, std::size_t capacity = 256, std::uint64_t ttl_ms = 0);
+
+		secret_cache(const secret_cache&) = delete;
+
+		~secret_cache();
+
+		// Get shared secret (cached or computed)
+		bool secret(const pubkey& peer, uchar* out_sha512);
+
+		// Wipe and remove cached secret for the peer
+		void erase(const pubkey& peer);
+
+		// Wipe and remove all cached secrets
+		void clear();
+
+		// Wipe and remove expired secrets (they are also removed lazily)
+		void expire();
+
+		std::size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_map.size();
+		}
+
+		std::uint64_t hits() const
+		{
+			return m_hits;
+		}
+
+		std::uint64_t misses() const
+		{
+			return m_misses;
+		}
+	};
+}
@@ -1,8 +1,18 @@
 #define NOMINMAX
 #include <ctime>
+#include <climits>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 #include <algorithm>
 #include "to_socket.hpp"
+#include "util/lfsync.h"
+#include "util/metrics.hpp"
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -12,9 +22,19 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/event.h>
+#endif
 #endif
 
 #ifdef _MSC_VER
@@ -73,80 +93,1395 @@ static inline bool has_blocked()
 	return WSAGetLastError() == WSAEWOULDBLOCK;
 }
 
-static constexpr auto poll = WSAPoll;
-#else
-static inline int make_socket(int s)
-{
-	return s;
+static constexpr auto poll = WSAPoll;
+#else
+static inline int make_socket(int s)
+{
+	return s;
+}
+
+static inline int close_socket(int s)
+{
+	return ::close(s);
+}
+
+static inline void set_nonblocking(int s)
+{
+	::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static inline bool has_blocked()
+{
+	return errno == EWOULDBLOCK || errno == EAGAIN;
+}
+#endif
+
+// Create non-blocking socket and initiate connection (returns -1 on failure)
+static int connect_socket(const ::addrinfo* info)
+{
+	int connection = make_socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+
+	if (connection == -1)
+	{
+		return -1;
+	}
+
+	set_nonblocking(connection);
+	::setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, sock_opt<int>{1}, sizeof(int));
+
+	if (::connect(connection, info->ai_addr, static_cast<int>(info->ai_addrlen)) != 0)
+	{
+#ifdef _WIN32
+		if (WSAGetLastError() != WSAEWOULDBLOCK)
+#else
+		if (errno != EINPROGRESS && errno != EAGAIN)
+#endif
+		{
+			::close_socket(connection);
+			return -1;
+		}
+	}
+
+	return connection;
+}
+
+namespace
+{
+	// Readiness event flags
+	enum : unsigned
+	{
+		ev_none  = 0,
+		ev_read  = 1,
+		ev_write = 2,
+		ev_error = 4,
+	};
+
+	struct poll_event
+	{
+		void* ptr;
+		unsigned events;
+	};
+
+	// Readiness notification backend (epoll, kqueue or WSAPoll) for a single waiting thread
+	class poller final
+	{
+#ifdef _WIN32
+		// Polling list, first element is the wakeup socket
+		std::vector<::pollfd> m_fds;
+
+		// User pointers for m_fds
+		std::vector<void*> m_ptrs;
+
+		// Socket -> m_fds index
+		std::unordered_map<int, std::size_t> m_index;
+#elif defined(__linux__)
+		int m_fd;
+
+		// Convert event flags to epoll events
+		static std::uint32_t epoll_events(unsigned events, bool edge)
+		{
+			std::uint32_t result = 0;
+
+			if (events & ev_read)
+			{
+				result |= EPOLLIN;
+			}
+
+			if (events & ev_write)
+			{
+				result |= EPOLLOUT;
+			}
+
+			if (edge)
+			{
+				result |= EPOLLET;
+			}
+
+			return result;
+		}
+#else
+		int m_fd;
+
+		// Pipe for wakeup
+		int m_pipe[2];
+#endif
+		// Wakeup handle (eventfd or UDP socket connected to itself)
+		int m_wake = -1;
+
+	public:
+		poller()
+		{
+#ifdef _WIN32
+			// Create loopback UDP socket connected to itself
+			::sockaddr_in addr{};
+			addr.sin_family      = AF_INET;
+			addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+			int addr_len = sizeof(addr);
+
+			m_wake = make_socket(::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+
+			if (m_wake != -1)
+			{
+				::bind(m_wake, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr));
+				::getsockname(m_wake, reinterpret_cast<::sockaddr*>(&addr), &addr_len);
+				::connect(m_wake, reinterpret_cast<::sockaddr*>(&addr), sizeof(addr));
+				set_nonblocking(m_wake);
+			}
+
+			m_fds.emplace_back();
+			m_fds[0].fd     = m_wake;
+			m_fds[0].events = POLLIN;
+			m_ptrs.emplace_back(nullptr);
+#elif defined(__linux__)
+			m_fd   = ::epoll_create1(EPOLL_CLOEXEC);
+			m_wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+			::epoll_event ev{};
+			ev.events   = EPOLLIN;
+			ev.data.ptr = nullptr;
+			::epoll_ctl(m_fd, EPOLL_CTL_ADD, m_wake, &ev);
+#else
+			m_fd = ::kqueue();
+			::pipe(m_pipe);
+			::fcntl(m_pipe[0], F_SETFL, ::fcntl(m_pipe[0], F_GETFL, 0) | O_NONBLOCK);
+			::fcntl(m_pipe[1], F_SETFL, ::fcntl(m_pipe[1], F_GETFL, 0) | O_NONBLOCK);
+			m_wake = m_pipe[1];
+
+			struct ::kevent ev;
+			EV_SET(&ev, m_pipe[0], EVFILT_READ, EV_ADD, 0, 0, nullptr);
+			::kevent(m_fd, &ev, 1, nullptr, 0, nullptr);
+#endif
+		}
+
+		poller(const poller&) = delete;
+
+		~poller()
+		{
+#ifdef _WIN32
+			::close_socket(m_wake);
+#elif defined(__linux__)
+			::close(m_wake);
+			::close(m_fd);
+#else
+			::close(m_pipe[0]);
+			::close(m_pipe[1]);
+			::close(m_fd);
+#endif
+		}
+
+		// Register socket
+		bool add(int s, void* ptr, unsigned events, bool edge = false)
+		{
+#ifdef _WIN32
+			if (!m_index.emplace(s, m_fds.size()).second)
+			{
+				return false;
+			}
+
+			m_fds.emplace_back();
+			m_fds.back().fd     = s;
+			m_fds.back().events = (events & ev_read ? POLLIN : 0) | (events & ev_write ? POLLOUT : 0);
+			m_ptrs.emplace_back(ptr);
+			return true;
+#elif defined(__linux__)
+			::epoll_event ev{};
+			ev.events   = epoll_events(events, edge);
+			ev.data.ptr = ptr;
+			return ::epoll_ctl(m_fd, EPOLL_CTL_ADD, s, &ev) == 0;
+#else
+			struct ::kevent ev[2];
+			const unsigned short flags = EV_ADD | (edge ? EV_CLEAR : 0);
+			EV_SET(&ev[0], s, EVFILT_READ, flags | (events & ev_read ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+			EV_SET(&ev[1], s, EVFILT_WRITE, flags | (events & ev_write ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+			return ::kevent(m_fd, ev, 2, nullptr, 0, nullptr) == 0;
+#endif
+		}
+
+		// Change requested events
+		bool modify(int s, void* ptr, unsigned events, bool edge = false)
+		{
+#ifdef _WIN32
+			const auto found = m_index.find(s);
+
+			if (found == m_index.end())
+			{
+				return false;
+			}
+
+			m_fds[found->second].events = (events & ev_read ? POLLIN : 0) | (events & ev_write ? POLLOUT : 0);
+			m_ptrs[found->second] = ptr;
+			return true;
+#elif defined(__linux__)
+			::epoll_event ev{};
+			ev.events   = epoll_events(events, edge);
+			ev.data.ptr = ptr;
+			return ::epoll_ctl(m_fd, EPOLL_CTL_MOD, s, &ev) == 0;
+#else
+			// EV_ADD modifies existing filters
+			return add(s, ptr, events, edge);
+#endif
+		}
+
+		// Unregister socket (must be called before closing it)
+		void remove(int s)
+		{
+#ifdef _WIN32
+			const auto found = m_index.find(s);
+
+			if (found == m_index.end())
+			{
+				return;
+			}
+
+			// Move the last element into the free location
+			const std::size_t pos = found->second;
+			m_index.erase(found);
+
+			if (pos + 1 < m_fds.size())
+			{
+				m_fds[pos]  = m_fds.back();
+				m_ptrs[pos] = m_ptrs.back();
+				m_index[m_fds[pos].fd] = pos;
+			}
+
+			m_fds.pop_back();
+			m_ptrs.pop_back();
+#elif defined(__linux__)
+			::epoll_event ev{};
+			::epoll_ctl(m_fd, EPOLL_CTL_DEL, s, &ev);
+#else
+			struct ::kevent ev[2];
+			EV_SET(&ev[0], s, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+			EV_SET(&ev[1], s, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+			::kevent(m_fd, ev, 2, nullptr, 0, nullptr);
+#endif
+		}
+
+		// Wait for events (timeout in ms, -1 = infinite), wakeup is not reported as event
+		int wait(poll_event* out, int max, int timeout)
+		{
+			int count = 0;
+
+#ifdef _WIN32
+			if (::poll(m_fds.data(), static_cast<u_long>(m_fds.size()), timeout) < 0)
+			{
+				return -1;
+			}
+
+			for (std::size_t i = 1; i < m_fds.size() && count < max; i++)
+			{
+				if (const short rev = m_fds[i].revents)
+				{
+					m_fds[i].revents = 0;
+					out[count].ptr    = m_ptrs[i];
+					out[count].events = (rev & POLLIN ? ev_read : ev_none) | (rev & POLLOUT ? ev_write : ev_none) | (rev & ~(POLLIN | POLLOUT) ? ev_error : ev_none);
+					count++;
+				}
+			}
+
+			if (m_fds[0].revents)
+			{
+				m_fds[0].revents = 0;
+
+				char buf[64];
+				while (::recv(m_wake, buf, sizeof(buf), 0) > 0)
+				{
+				}
+			}
+#elif defined(__linux__)
+			::epoll_event evs[64];
+
+			const int res = ::epoll_wait(m_fd, evs, std::min(max, 64), timeout);
+
+			if (res < 0)
+			{
+				return errno == EINTR ? 0 : -1;
+			}
+
+			for (int i = 0; i < res; i++)
+			{
+				if (!evs[i].data.ptr)
+				{
+					std::uint64_t value;
+					::read(m_wake, &value, sizeof(value));
+					continue;
+				}
+
+				const std::uint32_t rev = evs[i].events;
+				out[count].ptr    = evs[i].data.ptr;
+				out[count].events = (rev & EPOLLIN ? ev_read : ev_none) | (rev & EPOLLOUT ? ev_write : ev_none) | (rev & (EPOLLERR | EPOLLHUP) ? ev_error : ev_none);
+				count++;
+			}
+#else
+			struct ::kevent evs[64];
+			struct ::timespec ts;
+			ts.tv_sec  = timeout / 1000;
+			ts.tv_nsec = timeout % 1000 * 1000000;
+
+			const int res = ::kevent(m_fd, nullptr, 0, evs, std::min(max, 64), timeout < 0 ? nullptr : &ts);
+
+			if (res < 0)
+			{
+				return errno == EINTR ? 0 : -1;
+			}
+
+			for (int i = 0; i < res; i++)
+			{
+				if (!evs[i].udata)
+				{
+					char buf[64];
+					while (::read(m_pipe[0], buf, sizeof(buf)) > 0)
+					{
+					}
+
+					continue;
+				}
+
+				// Read and write filters are reported separately, merge adjacent ones
+				const unsigned rev =
+					(evs[i].flags & EV_ERROR ? ev_error : ev_none) |
+					(evs[i].filter == EVFILT_READ ? ev_read : ev_none) |
+					(evs[i].filter == EVFILT_WRITE ? (evs[i].flags & EV_EOF ? ev_error : ev_write) : ev_none);
+
+				if (count && out[count - 1].ptr == evs[i].udata)
+				{
+					out[count - 1].events |= rev;
+					continue;
+				}
+
+				out[count].ptr    = evs[i].udata;
+				out[count].events = rev;
+				count++;
+			}
+#endif
+			return count;
+		}
+
+		// Interrupt waiting (thread-safe)
+		void wake()
+		{
+#ifdef _WIN32
+			::send(m_wake, "\1", 1, 0);
+#elif defined(__linux__)
+			const std::uint64_t value = 1;
+			::write(m_wake, &value, sizeof(value));
+#else
+			::write(m_wake, "\1", 1);
+#endif
+		}
+	};
+
+	// Hierarchical timer wheel with 1 ms ticks: 6 levels of 64 slots (about 795 days range).
+	// Timers are intrusive nodes (no allocation), arm and cancel are O(1).
+	// Timers of upper levels are moved down when their slot is reached, so expiration is exact.
+	template <typename T>
+	class timer_wheel final
+	{
+		static constexpr unsigned s_bits = 6;
+		static constexpr unsigned s_levels = 6;
+		static constexpr std::uint32_t s_slots = 1u << s_bits;
+
+		// Node position for detached and expiring nodes
+		static constexpr std::uint32_t s_none = -1;
+		static constexpr std::uint32_t s_taken = -2;
+
+		struct link
+		{
+			link* prev;
+			link* next;
+		};
+
+	public:
+		struct node : link
+		{
+			std::uint64_t deadline;
+
+			T* value = nullptr;
+
+			// Level * s_slots + slot
+			std::uint32_t pos = s_none;
+
+			node()
+				: link{nullptr, nullptr}
+			{
+			}
+
+			node(const node&) = delete;
+
+			bool armed() const
+			{
+				return pos != s_none;
+			}
+		};
+
+	private:
+		link m_slots[s_levels][s_slots];
+
+		// Non-empty slot bits
+		std::uint64_t m_used[s_levels]{};
+
+		// Next tick to process
+		std::uint64_t m_now;
+
+		std::size_t m_count = 0;
+
+		static void push(link& head, link* n)
+		{
+			n->prev = head.prev;
+			n->next = &head;
+			head.prev->next = n;
+			head.prev = n;
+		}
+
+		void insert(node* n)
+		{
+			// Relative level selection
+			const std::uint64_t delta = n->deadline - m_now;
+
+			unsigned level = 0;
+
+			while (level + 1 < s_levels && delta >> (s_bits * (level + 1)))
+			{
+				level++;
+			}
+
+			const std::uint32_t slot = static_cast<std::uint32_t>(n->deadline >> (s_bits * level)) & (s_slots - 1);
+			push(m_slots[level][slot], n);
+			m_used[level] |= 1ull << slot;
+			n->pos = level * s_slots + slot;
+		}
+
+		void unlink(node* n)
+		{
+			n->prev->next = n->next;
+			n->next->prev = n->prev;
+
+			if (n->pos != s_taken)
+			{
+				link& head = m_slots[n->pos / s_slots][n->pos % s_slots];
+
+				if (head.next == &head)
+				{
+					m_used[n->pos / s_slots] &= ~(1ull << (n->pos % s_slots));
+				}
+			}
+
+			n->pos = s_none;
+		}
+
+		// Move slot contents to the list
+		void take(unsigned level, std::uint32_t slot, link& list)
+		{
+			link& head = m_slots[level][slot];
+
+			while (head.next != &head)
+			{
+				node* const n = static_cast<node*>(head.next);
+				head.next = n->next;
+				n->pos = s_taken;
+				push(list, n);
+			}
+
+			head.prev = &head;
+			m_used[level] &= ~(1ull << slot);
+		}
+
+	public:
+		explicit timer_wheel(std::uint64_t now)
+			: m_now(now)
+		{
+			for (auto& level : m_slots)
+			{
+				for (auto& head : level)
+				{
+					head = {&head, &head};
+				}
+			}
+		}
+
+		timer_wheel(const timer_wheel&) = delete;
+
+		std::size_t size() const
+		{
+			return m_count;
+		}
+
+		// Arm or rearm the timer (deadline in ms)
+		void arm(node& n, T* value, std::uint64_t deadline)
+		{
+			cancel(n);
+
+			// Past deadlines expire on the next tick
+			const std::uint64_t max = m_now + (1ull << (s_bits * s_levels)) - 1;
+			n.deadline = deadline < m_now ? m_now : deadline > max ? max : deadline;
+			n.value = value;
+			insert(&n);
+			m_count++;
+		}
+
+		void cancel(node& n)
+		{
+			if (n.armed())
+			{
+				unlink(&n);
+				m_count--;
+			}
+		}
+
+		// Get the time of the nearest event (expiration or moving timers down), -1 if none
+		std::uint64_t next() const
+		{
+			if (!m_count)
+			{
+				return -1;
+			}
+
+			std::uint64_t result = -1;
+
+			for (unsigned level = 0; level < s_levels; level++)
+			{
+				if (!m_used[level])
+				{
+					continue;
+				}
+
+				const unsigned shift = s_bits * level;
+				const std::uint64_t block = m_now >> shift;
+
+				// Slot of the current tick is pending if not moved down yet (always for level 0)
+				const bool pending = level == 0 || (m_now & ((1ull << shift) - 1)) == 0;
+				const unsigned first = static_cast<unsigned>((block + (pending ? 0 : 1)) & (s_slots - 1));
+
+				// Rotate to find the first used slot starting from the slot of the first event
+				const std::uint64_t bits = first ? (m_used[level] >> first | m_used[level] << (s_slots - first)) : m_used[level];
+
+				unsigned dist = 0;
+
+				while (!(bits >> dist & 1))
+				{
+					dist++;
+				}
+
+				result = std::min(result, (block + (pending ? 0 : 1) + dist) << shift);
+			}
+
+			return result;
+		}
+
+		// Process all ticks up to now, call func(T*) for expired timers (can arm and cancel timers)
+		template <typename F>
+		void advance(std::uint64_t now, F&& func)
+		{
+			while (m_now <= now)
+			{
+				const std::uint64_t event = next();
+
+				if (event > now)
+				{
+					// Skip empty ticks
+					m_now = now + 1;
+					break;
+				}
+
+				m_now = event;
+
+				// Move timers down from upper levels at the block boundaries
+				for (unsigned level = 1; level < s_levels && (m_now & ((1ull << (s_bits * level)) - 1)) == 0; level++)
+				{
+					link list{&list, &list};
+					take(level, static_cast<std::uint32_t>(m_now >> (s_bits * level)) & (s_slots - 1), list);
+
+					while (list.next != &list)
+					{
+						node* const n = static_cast<node*>(list.next);
+						list.next = n->next;
+						insert(n);
+					}
+				}
+
+				link expired{&expired, &expired};
+				take(0, static_cast<std::uint32_t>(m_now) & (s_slots - 1), expired);
+				m_now++;
+
+				while (expired.next != &expired)
+				{
+					node* const n = static_cast<node*>(expired.next);
+					unlink(n);
+					m_count--;
+					func(n->value);
+				}
+			}
+		}
+	};
+
+	// Engine command
+	enum class command
+	{
+		add,
+		signal,
+		release,
+	};
+
+	// Reconnection delay after failed connection attempt (ms)
+	constexpr std::uint64_t s_retry_delay = 1000;
+
+	std::uint64_t get_time_ms()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	metrics::counter s_accepted("to_connections_accepted_total", "Connections accepted by server_thread");
+	metrics::counter s_rejected("to_connections_rejected_total", "Connections rejected by server_thread (preliminary or final)");
+	metrics::histogram s_callback_time("to_callback_seconds", "Duration of connection callbacks", 1e-9);
+
+	// Call the connection callback measuring its duration
+	to::cb_res check(const std::function<to::cb_res(to::cb_arg&)>& on_check, to::cb_arg& arg)
+	{
+		metrics::span span(s_callback_time);
+		return on_check(arg);
+	}
+}
+
+struct to::socket_engine::entry
+{
+	// Owner object (cleared after release)
+	socket_thread* owner;
+
+	std::function<cb_res(cb_arg&)> on_check;
+
+	// Worker index
+	std::size_t worker;
+
+	// Connection socket (-1 if not created)
+	int sock = -1;
+
+	// Requested events
+	unsigned events = 0;
+
+	bool connected = false;
+
+	// Client address info (for reconnection)
+	::addrinfo* info = nullptr;
+
+	// Connection timeout or reconnection delay
+	timer_wheel<entry>::node timer;
+
+	// Keeps the entry alive while it is active
+	std::shared_ptr<entry> self;
+};
+
+struct to::socket_engine::worker
+{
+	poller poll;
+
+	// Commands from other threads
+	lfs::list<std::pair<std::shared_ptr<entry>, command>> queue;
+
+	// Connection timeouts
+	timer_wheel<entry> timers{get_time_ms()};
+
+	// Finished entries (freed after processing the current batch of events)
+	std::vector<std::shared_ptr<entry>> garbage;
+
+	// Release acknowledgement
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	std::atomic<bool> quit{false};
+
+	std::thread thread;
+
+	void post(const std::shared_ptr<entry>& e, command cmd)
+	{
+		// Only the first command after draining needs the wakeup
+		if (queue.push(e, cmd))
+		{
+			poll.wake();
+		}
+	}
+
+	void arm(entry* e, std::uint64_t delay)
+	{
+		timers.arm(e->timer, e, get_time_ms() + delay);
+	}
+
+	void disarm(entry* e)
+	{
+		timers.cancel(e->timer);
+	}
+
+	// Arm connection timeout
+	void arm(entry* e)
+	{
+		if (e->owner && e->owner->m_timeout >= 0)
+		{
+			arm(e, e->owner->m_timeout);
+		}
+		else
+		{
+			disarm(e);
+		}
+	}
+
+	// Start new connection attempt
+	void connect(entry* e)
+	{
+		e->sock = connect_socket(e->info);
+
+		if (e->sock == -1)
+		{
+			deactivate(e);
+			return;
+		}
+
+		e->connected = false;
+		e->events    = ev_write;
+		poll.add(e->sock, e, e->events);
+		arm(e);
+	}
+
+	// Close the connection, then reconnect or deactivate
+	void finish(entry* e)
+	{
+		const bool was_connected = e->connected;
+
+		if (was_connected)
+		{
+			cb_arg arg = cb_arg::terminate;
+			// Restore the outer callback's entry if called from it
+			const auto prev = std::exchange(t_current, e);
+			e->on_check(arg);
+			t_current = prev;
+		}
+
+		disarm(e);
+
+		if (e->sock != -1)
+		{
+			poll.remove(e->sock);
+			::close_socket(e->sock);
+			e->sock   = -1;
+		}
+
+		e->connected = false;
+
+		if (e->info && e->owner && e->owner->m_state != thread_state::terminated)
+		{
+			// Reconnect (delayed if the connection attempt failed)
+			arm(e, was_connected ? 0 : s_retry_delay);
+			return;
+		}
+
+		deactivate(e);
+	}
+
+	// Stop processing the connection
+	void deactivate(entry* e)
+	{
+		disarm(e);
+
+		if (e->info)
+		{
+			::freeaddrinfo(e->info);
+			e->info = nullptr;
+		}
+
+		if (e->owner)
+		{
+			e->owner->m_state = thread_state::terminated;
+		}
+
+		garbage.emplace_back(std::move(e->self));
+	}
+
+	// Process socket events (revents = 0: signal or timeout)
+	void dispatch(entry* e, unsigned revents, bool signal)
+	{
+		if (!e->self || e->sock == -1)
+		{
+			return;
+		}
+
+		if (revents & ev_error || !e->owner || e->owner->m_state == thread_state::terminated)
+		{
+			finish(e);
+			return;
+		}
+
+		// Check connection result
+		if (revents && !e->connected)
+		{
+			sock_opt<int> err{-1};
+			::socklen_t err_len = sizeof(int);
+			::getsockopt(e->sock, SOL_SOCKET, SO_ERROR, err, &err_len);
+
+			if (err.value != 0)
+			{
+				finish(e);
+				return;
+			}
+
+			e->owner->m_socket = e->sock;
+			e->owner->m_time   = std::time(nullptr);
+			e->connected       = true;
+			revents &= ~ev_write;
+		}
+
+		// Don't call the callback until the connection succeeds
+		if (!e->connected)
+		{
+			arm(e);
+			return;
+		}
+
+		cb_arg arg;
+
+		if (revents & ev_read && revents & ev_write)
+		{
+			arg = cb_arg::signal_both;
+		}
+		else if (revents & ev_write)
+		{
+			arg = cb_arg::signal_write;
+		}
+		else if (revents & ev_read)
+		{
+			arg = cb_arg::signal_read;
+		}
+		else if (signal)
+		{
+			arg = cb_arg::signal_none;
+		}
+		else
+		{
+			arg = cb_arg::signal_timeout;
+		}
+
+		unsigned new_events = e->events;
+
+		while (true)
+		{
+			const auto prev = std::exchange(t_current, e);
+			const cb_res res = check(e->on_check, arg);
+			t_current = prev;
+
+			// Process callback result
+			switch (res)
+			{
+			case cb_res::terminate: finish(e); return;
+			case cb_res::wait_none: new_events = 0; break;
+			case cb_res::wait_read: new_events = ev_read; break;
+			case cb_res::wait_both: new_events = ev_read | ev_write; break;
+			case cb_res::wait_write: new_events = ev_write; break;
+			case cb_res::retry: continue;
+			}
+
+			break;
+		}
+
+		// Terminated from the callback
+		if (!e->owner || e->owner->m_state == thread_state::terminated)
+		{
+			finish(e);
+			return;
+		}
+
+		if (new_events != e->events)
+		{
+			// Update event list when necessary
+			poll.modify(e->sock, e, new_events);
+			e->events = new_events;
+		}
+
+		arm(e);
+	}
+
+	// Process timer expiration
+	void expire(entry* e)
+	{
+		if (e->sock == -1)
+		{
+			// Reconnection
+			connect(e);
+			return;
+		}
+
+		dispatch(e, 0, false);
+	}
+
+	void release(const std::shared_ptr<entry>& e)
+	{
+		if (e->self)
+		{
+			if (e->owner)
+			{
+				e->owner->m_state = thread_state::terminated;
+			}
+
+			// Disable reconnection
+			if (e->info)
+			{
+				::freeaddrinfo(e->info);
+				e->info = nullptr;
+			}
+
+			finish(e.get());
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			e->owner = nullptr;
+		}
+
+		cv.notify_all();
+	}
+
+	void process(const std::shared_ptr<entry>& e, command cmd)
+	{
+		switch (cmd)
+		{
+		case command::add:
+		{
+			if (!e->owner)
+			{
+				// Released before start
+				break;
+			}
+
+			e->self = e;
+
+			if (e->info)
+			{
+				connect(e.get());
+				break;
+			}
+
+			e->events = ev_read | ev_write;
+			poll.add(e->sock, e.get(), e->events);
+			arm(e.get());
+			break;
+		}
+		case command::signal:
+		{
+			dispatch(e.get(), 0, true);
+			break;
+		}
+		case command::release:
+		{
+			release(e);
+			break;
+		}
+		}
+	}
+
+	void run()
+	{
+		t_worker = this;
+
+		poll_event events[64];
+
+		while (!quit)
+		{
+			int timeout = -1;
+
+			if (timers.size())
+			{
+				const std::uint64_t now = get_time_ms();
+				const std::uint64_t next = timers.next();
+				timeout = next <= now ? 0 : static_cast<int>(std::min<std::uint64_t>(next - now, INT_MAX));
+			}
+
+			const int count = poll.wait(events, 64, timeout);
+
+			for (int i = 0; i < count; i++)
+			{
+				dispatch(static_cast<entry*>(events[i].ptr), events[i].events, false);
+			}
+
+			queue.apply([this](std::pair<std::shared_ptr<entry>, command>& cmd)
+			{
+				process(cmd.first, cmd.second);
+			});
+
+			timers.advance(get_time_ms(), [this](entry* e)
+			{
+				expire(e);
+			});
+
+			garbage.clear();
+		}
+	}
+
+	// Current worker thread
+	static thread_local worker* t_worker;
+
+	// Current connection in callback
+	static thread_local entry* t_current;
+};
+
+thread_local to::socket_engine::worker* to::socket_engine::worker::t_worker = nullptr;
+
+thread_local to::socket_engine::entry* to::socket_engine::worker::t_current = nullptr;
+
+to::socket_engine::socket_engine(std::size_t threads)
+{
+#ifdef _WIN32
+	::WSADATA wsaData;
+	::WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+	if (threads == 0)
+	{
+		threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+	}
+
+	for (std::size_t i = 0; i < threads; i++)
+	{
+		m_workers.emplace_back(new worker);
+	}
+
+	for (auto& w : m_workers)
+	{
+		w->thread = std::thread([w = w.get()]
+		{
+			w->run();
+		});
+	}
+}
+
+to::socket_engine::~socket_engine()
+{
+	for (auto& w : m_workers)
+	{
+		w->quit = true;
+		w->poll.wake();
+	}
+
+	for (auto& w : m_workers)
+	{
+		w->thread.join();
+	}
+
+#ifdef _WIN32
+	::WSACleanup();
+#endif
+}
+
+int to::send(int s, const void* ptr, std::size_t size)
+{
+	int r = std::max(-1, ::send(s, static_cast<const char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), 0));
+
+	if (r == -1 && has_blocked())
+	{
+		return 0;
+	}
+
+	if (r == 0 && size > 0)
+	{
+		return -2;
+	}
+
+	return r;
+}
+
+int to::recv(int s, void* ptr, std::size_t size)
+{
+	int r = std::max(-1, ::recv(s, static_cast<char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), 0));
+
+	if (r == -1 && has_blocked())
+	{
+		return 0;
+	}
+
+	if (r == 0 && size > 0)
+	{
+		return -2;
+	}
+
+	return r;
+}
+
+int to::peek(int s, void* ptr, std::size_t size)
+{
+	int r = std::max(-1, ::recv(s, static_cast<char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), MSG_PEEK));
+
+	if (r == -1 && has_blocked())
+	{
+		return 0;
+	}
+
+	if (r == 0 && size > 0)
+	{
+		return -2;
+	}
+
+	return r;
+}
+
+constexpr std::size_t to::send_queue::s_chunk;
+constexpr std::size_t to::send_queue::s_min_ref;
+constexpr std::size_t to::send_queue::s_max_iov;
+
+int to::sendv(int s, const io_buf* bufs, std::size_t count)
+{
+	count = std::min(count, send_queue::s_max_iov);
+
+	// Total size is limited by INT_MAX
+	std::size_t size = 0;
+
+#ifdef _WIN32
+	WSABUF iov[send_queue::s_max_iov];
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		iov[i].buf = static_cast<char*>(const_cast<void*>(bufs[i].ptr));
+		iov[i].len = static_cast<ULONG>(std::min<std::size_t>(bufs[i].size, INT_MAX - size));
+		size += iov[i].len;
+	}
+
+	DWORD sent = 0;
+	int r = ::WSASend(s, iov, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr) == 0 ? static_cast<int>(sent) : -1;
+#else
+	::iovec iov[send_queue::s_max_iov];
+
+	for (std::size_t i = 0; i < count; i++)
+	{
+		iov[i].iov_base = const_cast<void*>(bufs[i].ptr);
+		iov[i].iov_len = std::min<std::size_t>(bufs[i].size, INT_MAX - size);
+		size += iov[i].iov_len;
+	}
+
+	::msghdr msg{};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	int r = static_cast<int>(std::max<::ssize_t>(-1, ::sendmsg(s, &msg, 0)));
+#endif
+
+	if (r == -1 && has_blocked())
+	{
+		return 0;
+	}
+
+	if (r == 0 && size > 0)
+	{
+		return -2;
+	}
+
+	return r;
+}
+
+void to::send_queue::write(const void* ptr, std::size_t size)
+{
+	auto src = static_cast<const uchar*>(ptr);
+
+	m_size += size;
+
+	while (size)
+	{
+		// Append to the last own chunk
+		if (!m_segs.empty() && m_segs.back().chunk && m_segs.back().size < s_chunk)
+		{
+			segment& last = m_segs.back();
+			const std::size_t n = std::min(size, s_chunk - last.size);
+			std::memcpy(last.chunk.get() + last.size, src, n);
+			last.size += n;
+			src += n;
+			size -= n;
+			continue;
+		}
+
+		std::unique_ptr<uchar[]> chunk;
+
+		if (m_free.empty())
+		{
+			chunk.reset(new uchar[s_chunk]);
+		}
+		else
+		{
+			chunk = std::move(m_free.back());
+			m_free.pop_back();
+		}
+
+		const uchar* data = chunk.get();
+		m_segs.push_back(segment{data, 0, std::move(chunk), nullptr});
+	}
+}
+
+void to::send_queue::write(std::shared_ptr<const void> owner, const void* ptr, std::size_t size)
+{
+	if (size < s_min_ref)
+	{
+		return write(ptr, size);
+	}
+
+	m_segs.push_back(segment{static_cast<const uchar*>(ptr), size, nullptr, std::move(owner)});
+	m_size += size;
+}
+
+int to::send_queue::flush(int s)
+{
+	int total = 0;
+
+	while (m_size)
+	{
+		io_buf bufs[s_max_iov];
+		std::size_t count = 0;
+		std::size_t size = 0;
+
+		for (auto& seg : m_segs)
+		{
+			if (count == s_max_iov)
+			{
+				break;
+			}
+
+			const std::size_t skip = count ? 0 : m_offset;
+			bufs[count++] = {seg.ptr + skip, seg.size - skip};
+			size += seg.size - skip;
+		}
+
+		const int r = to::sendv(s, bufs, count);
+
+		if (r <= 0)
+		{
+			return total ? total : r;
+		}
+
+		total = static_cast<int>(std::min<std::size_t>(std::size_t{INT_MAX}, std::size_t(total) + r));
+		m_size -= r;
+
+		// Remove sent segments
+		for (std::size_t n = r; n;)
+		{
+			segment& first = m_segs.front();
+
+			if (first.size - m_offset > n)
+			{
+				m_offset += n;
+				break;
+			}
+
+			n -= first.size - m_offset;
+			m_offset = 0;
+
+			if (first.chunk)
+			{
+				m_free.emplace_back(std::move(first.chunk));
+			}
+
+			m_segs.pop_front();
+		}
+
+		// Socket buffer is full
+		if (static_cast<std::size_t>(r) < std::min<std::size_t>(size, INT_MAX))
+		{
+			break;
+		}
+	}
+
+	// Keep a few chunks
+	if (m_free.size() > 4)
+	{
+		m_free.resize(4);
+	}
+
+	return total;
 }
 
-static inline int close_socket(int s)
+void to::send_queue::clear()
 {
-	return ::close(s);
-}
+	while (!m_segs.empty())
+	{
+		if (m_segs.front().chunk)
+		{
+			m_free.emplace_back(std::move(m_segs.front().chunk));
+		}
 
-static inline void set_nonblocking(int s)
-{
-	::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+		m_segs.pop_front();
+	}
+
+	m_offset = 0;
+	m_size = 0;
 }
 
-static inline bool has_blocked()
+to::recv_buffer::recv_buffer(std::size_t capacity)
+	: m_data(new uchar[capacity])
+	, m_cap(capacity)
 {
-	return errno == EWOULDBLOCK || errno == EAGAIN;
 }
-#endif
 
-int to::send(int s, const void* ptr, std::size_t size)
+int to::recv_buffer::fill(int s)
 {
-	int r = std::max(-1, ::send(s, static_cast<const char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), 0));
-
-	if (r == -1 && has_blocked())
+	if (m_begin == m_end)
 	{
-		return 0;
+		m_begin = 0;
+		m_end = 0;
 	}
-
-	if (r == 0 && size > 0)
+	else if (m_end == m_cap && m_begin)
 	{
-		return -2;
+		// Move incomplete frame to the front
+		std::memmove(m_data.get(), m_data.get() + m_begin, m_end - m_begin);
+		m_end -= m_begin;
+		m_begin = 0;
 	}
 
-	return r;
-}
-
-int to::recv(int s, void* ptr, std::size_t size)
-{
-	int r = std::max(-1, ::recv(s, static_cast<char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), 0));
-
-	if (r == -1 && has_blocked())
+	if (m_end == m_cap)
 	{
 		return 0;
 	}
 
-	if (r == 0 && size > 0)
+	const int r = to::recv(s, m_data.get() + m_end, m_cap - m_end);
+
+	if (r > 0)
 	{
-		return -2;
+		m_end += r;
 	}
 
 	return r;
 }
 
-int to::peek(int s, void* ptr, std::size_t size)
+const uchar* to::recv_buffer::frame(std::size_t size)
 {
-	int r = std::max(-1, ::recv(s, static_cast<char*>(ptr), size > INT_MAX ? INT_MAX : static_cast<int>(size), MSG_PEEK));
-
-	if (r == -1 && has_blocked())
+	if (m_end - m_begin >= size)
 	{
-		return 0;
+		return m_data.get() + m_begin;
 	}
 
-	if (r == 0 && size > 0)
+	if (size > m_cap - m_begin)
 	{
-		return -2;
+		if (size > m_cap)
+		{
+			// Grow buffer
+			std::unique_ptr<uchar[]> data(new uchar[size]);
+			std::memcpy(data.get(), m_data.get() + m_begin, m_end - m_begin);
+			m_data = std::move(data);
+			m_cap = size;
+		}
+		else
+		{
+			std::memmove(m_data.get(), m_data.get() + m_begin, m_end - m_begin);
+		}
+
+		m_end -= m_begin;
+		m_begin = 0;
 	}
 
-	return r;
+	return nullptr;
+}
+
+void to::recv_buffer::consume(std::size_t size)
+{
+	m_begin += std::min(size, m_end - m_begin);
 }
 
+struct to::server_thread::shard
+{
+	std::thread thread;
+
+	poller poll;
+};
+
 to::server_thread::server_thread()
 {
 #ifdef _WIN32
@@ -164,157 +1499,304 @@ to::server_thread::~server_thread()
 #endif
 }
 
-void to::server_thread::start(const char* bind_addr, const char* bind_port, const accept_func& on_accept)
+// Create listener socket (returns -1 on failure)
+static int listen_socket(const ::addrinfo* info, bool reuse_port)
+{
+	int listener = make_socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+
+	if (listener != -1)
+	{
+		::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, sock_opt<int>{1}, sizeof(int));
+		::setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, sock_opt<int>{0}, sizeof(int));
+#ifdef SO_REUSEPORT
+		if (reuse_port)
+		{
+			::setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, sock_opt<int>{1}, sizeof(int));
+		}
+#endif
+		set_nonblocking(listener);
+
+		if (::bind(listener, info->ai_addr, static_cast<int>(info->ai_addrlen)) == 0 && ::listen(listener, SOMAXCONN) == 0)
+		{
+			return listener;
+		}
+
+		::close_socket(listener);
+	}
+
+	return -1;
+}
+
+// Socket handle as poller user pointer (null is reserved)
+static inline void* socket_token(int s)
+{
+	return reinterpret_cast<void*>(static_cast<std::uintptr_t>(s) + 1);
+}
+
+static inline int token_socket(void* ptr)
+{
+	return static_cast<int>(reinterpret_cast<std::uintptr_t>(ptr) - 1);
+}
+
+// Accept all pending connections, returns false if the listener is broken
+static bool accept_all(poller& poll, int listener, int& reserve, std::unordered_set<int>& pending)
+{
+	while (true)
+	{
+		const int accepted = make_socket(::accept(listener, 0, 0));
+
+		if (accepted != -1)
+		{
+			// Upon accepting, add socket to the polling queue
+			if (!poll.add(accepted, socket_token(accepted), ev_read))
+			{
+				::close_socket(accepted);
+				continue;
+			}
+
+			pending.emplace(accepted);
+			continue;
+		}
+
+		if (has_blocked())
+		{
+			return true;
+		}
+
+#ifdef _WIN32
+		// WSAPoll is level-triggered and reports the remaining backlog again
+		(void)poll;
+		(void)reserve;
+		return WSAGetLastError() != WSAENOTSOCK && WSAGetLastError() != WSAEINVAL;
+#else
+		switch (errno)
+		{
+		case EBADF:
+		case EINVAL:
+		case ENOTSOCK:
+		case EFAULT:
+		{
+			return false;
+		}
+		case EMFILE:
+		case ENFILE:
+		{
+			if (reserve != -1)
+			{
+				// Out of descriptors: drop the connection using the reserved one
+				::close(reserve);
+
+				const int dropped = ::accept(listener, 0, 0);
+
+				if (dropped != -1)
+				{
+					::close(dropped);
+				}
+
+				reserve = ::open("/dev/null", O_RDONLY);
+				continue;
+			}
+		}
+		// Fall through
+		case ENOBUFS:
+		case ENOMEM:
+		{
+			// Backlog is left non-empty: re-arm to get a new edge on the next wait
+			poll.modify(listener, socket_token(listener), ev_read, true);
+			return true;
+		}
+		default:
+		{
+			// The failed connection is consumed (ECONNABORTED, EPROTO, EINTR, ...)
+			continue;
+		}
+		}
+#endif
+	}
+}
+
+void to::server_thread::start(const char* bind_addr, const char* bind_port, const accept_func& on_accept, std::size_t shards)
 {
 	terminate();
 
+#ifndef SO_REUSEPORT
+	shards = 1;
+#endif
+
 	// Get addr info
 	struct ::addrinfo hints{};
 	struct ::addrinfo* info;
 	hints.ai_flags = AI_PASSIVE;
 	hints.ai_socktype = SOCK_STREAM;
 
-	if (::getaddrinfo(bind_addr, bind_port, &hints, &info) == 0)
+	if (::getaddrinfo(bind_addr, bind_port, &hints, &info) != 0)
+	{
+		return;
+	}
+
+	std::vector<int> listeners;
+
+	for (std::size_t i = 0; i < std::max<std::size_t>(shards, 1); i++)
 	{
 		// Create listener socket
-		int listener = make_socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+		const int listener = listen_socket(info, shards > 1);
+
+		if (listener == -1)
+		{
+			break;
+		}
+
+		listeners.emplace_back(listener);
+	}
 
-		if (listener != -1)
+	::freeaddrinfo(info);
+
+	if (listeners.size() != std::max<std::size_t>(shards, 1))
+	{
+		for (int listener : listeners)
+		{
+			::close_socket(listener);
+		}
+
+		return;
+	}
+
+	m_state = thread_state::running;
+
+	// Number of running shards, the last one sets the terminated state
+	const auto live = std::make_shared<std::atomic<std::size_t>>(listeners.size());
+
+	for (int listener : listeners)
+	{
+		m_shards.emplace_back(new shard);
+
+		shard& sh = *m_shards.back();
+
+		// Edge-triggered: accept until the backlog is empty
+		sh.poll.add(listener, socket_token(listener), ev_read, true);
+
+		sh.thread = std::thread([=, &sh]()
 		{
-			::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, sock_opt<int>{1}, sizeof(int));
-			::setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, sock_opt<int>{0}, sizeof(int));
-			set_nonblocking(listener);
+			// Accepted sockets waiting for the first data
+			std::unordered_set<int> pending;
+
+#ifdef _WIN32
+			int reserve = -1;
+#else
+			// Spare descriptor for dropping connections while out of descriptors
+			int reserve = ::open("/dev/null", O_RDONLY);
+#endif
 
-			if (::bind(listener, info->ai_addr, static_cast<int>(info->ai_addrlen)) == 0)
+			poll_event events[64];
+
+			// Wait without timeout, termination wakes up the poller
+			for (int count; (count = sh.poll.wait(events, 64, -1)) >= 0 && m_state != thread_state::terminated;)
 			{
-				if (::listen(listener, SOMAXCONN) == 0)
+				bool failed = false;
+
+				for (int i = 0; i < count; i++)
 				{
-					m_state  = thread_state::running;
-					m_thread = std::thread([=]()
+					const int socket = token_socket(events[i].ptr);
+
+					if (socket == listener)
 					{
-						std::vector<::pollfd> fds;
-						fds.emplace_back();
-						fds[0].fd      = listener;
-						fds[0].events  = POLLIN;
-						fds[0].revents = 0;
-
-						// Loop with 20 ms timeout and simple termination condition check
-						while (::poll(fds.data(), static_cast<u_long>(fds.size()), 20) >= 0 && !(fds[0].revents & ~POLLIN) && m_state != thread_state::terminated)
+						if ((events[i].events & ev_error) || !accept_all(sh.poll, listener, reserve, pending))
 						{
-							while (fds[0].revents & POLLIN)
-							{
-								int socket = make_socket(::accept(listener, 0, 0));
-
-								if (socket == -1)
-								{
-									fds[0].revents = 0;
-									break;
-								}
-
-								// Upon accepting, add socket to the polling queue
-								fds.emplace_back();
-								fds.back().fd      = socket;
-								fds.back().events  = POLLIN;
-								fds.back().revents = 0;
-							}
-
-							std::size_t nullstat = 0;
-							std::size_t allstat = fds.size() - 1;
-
-							for (auto& pfd : fds)
-							{
-								if (pfd.fd == -1)
-								{
-									nullstat++;
-								}
-
-								// Upon the first data available, try to read from socket and verify
-								if (pfd.fd != -1 && pfd.revents)
-								{
-									nullstat++;
-
-									// Get socket handle, reset poll location
-									const int socket = make_socket(std::exchange(pfd.fd, -1));
-
-									// Check for possible errors
-									if (socket == -1 || pfd.revents & ~POLLIN)
-									{
-										::close_socket(socket);
-										continue;
-									}
-
-									// Preliminary verification
-									if (!on_accept(socket, nullptr, nullptr) && allstat - nullstat > 3)
-									{
-										::close_socket(socket);
-										continue;
-									}
-
-									set_nonblocking(socket);
-									::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, sock_opt<int>{1}, sizeof(int));
-
-									// Get socket name
-									::sockaddr_storage addr;
-									int sock_len = sizeof(addr);
-									char hbuf[NI_MAXHOST];
-									char sbuf[NI_MAXSERV];
-									::getsockname(socket, (struct ::sockaddr*)&addr, &sock_len);
-									::getnameinfo((struct ::sockaddr*)&addr, sock_len, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf), NI_NUMERICHOST | NI_NUMERICSERV);
-
-									// Now should finally create a socket thread
-									if (!on_accept(socket, hbuf, sbuf))
-									{
-										::close_socket(socket);
-									}
-								}
-							}
-
-							if (nullstat >= allstat)
-							{
-								// Clean all (simple)
-								fds.resize(1);
-							}
-							else if (nullstat > allstat - allstat / 10)
-							{
-								// Clean all (hard way)
-								fds.erase(std::remove_if(fds.begin() + 1, fds.end(), [](auto& pfd) { return pfd.fd == -1; }), fds.end());
-							}
-							else if (nullstat > 10)
-							{
-								// Clean back (it's a dirty draft anyway)
-								for (std::size_t i = fds.size() - 1; ~i; i--)
-								{
-									if (fds[i].fd != -1)
-									{
-										fds.resize(i + 1);
-										break;
-									}
-								}
-							}
+							failed = true;
+							break;
 						}
 
-						::close_socket(listener);
-						::freeaddrinfo(info);
-						m_state = thread_state::terminated;
-					});
+						continue;
+					}
+
+					// Upon the first data available, try to read from socket and verify
+					sh.poll.remove(socket);
+					pending.erase(socket);
+
+					// Check for possible errors
+					if (events[i].events & ev_error)
+					{
+						::close_socket(socket);
+						continue;
+					}
+
+					// Preliminary verification
+					if (!on_accept(socket, nullptr, nullptr) && pending.size() > 3)
+					{
+						s_rejected.add();
+						::close_socket(socket);
+						continue;
+					}
+
+					set_nonblocking(socket);
+					::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, sock_opt<int>{1}, sizeof(int));
+
+					// Get socket name
+					::sockaddr_storage addr;
+					int sock_len = sizeof(addr);
+					char hbuf[NI_MAXHOST];
+					char sbuf[NI_MAXSERV];
+					::getsockname(socket, (struct ::sockaddr*)&addr, &sock_len);
+					::getnameinfo((struct ::sockaddr*)&addr, sock_len, hbuf, sizeof(hbuf), sbuf, sizeof(sbuf), NI_NUMERICHOST | NI_NUMERICSERV);
+
+					// Now should finally create a socket thread
+					if (!on_accept(socket, hbuf, sbuf))
+					{
+						s_rejected.add();
+						::close_socket(socket);
+						continue;
+					}
+
+					s_accepted.add();
+				}
 
-					return;
+				if (failed)
+				{
+					break;
 				}
 			}
 
+			for (const int socket : pending)
+			{
+				sh.poll.remove(socket);
+				::close_socket(socket);
+			}
+
+			sh.poll.remove(listener);
 			::close_socket(listener);
-		}
 
-		::freeaddrinfo(info);
+#ifndef _WIN32
+			if (reserve != -1)
+			{
+				::close(reserve);
+			}
+#endif
+			// Listener failure only stops this shard
+			if (--*live == 0)
+			{
+				m_state = thread_state::terminated;
+			}
+		});
 	}
 }
 
 void to::server_thread::terminate()
 {
-	if (m_thread.joinable())
+	if (!m_shards.empty())
 	{
 		m_state = thread_state::terminated;
-		m_thread.join();
+
+		for (auto& sh : m_shards)
+		{
+			sh->poll.wake();
+		}
+
+		for (auto& sh : m_shards)
+		{
+			sh->thread.join();
+		}
+
+		m_shards.clear();
 		m_state = thread_state::null;
 	}
 }
@@ -415,7 +1897,7 @@ bool to::socket_thread::task(int s, cb_arg& arg, const std::function<cb_res(cb_a
 			long new_events = last_events;
 
 			// Process callback result
-			switch (on_check(arg))
+			switch (check(on_check, arg))
 			{
 			case cb_res::terminate: return true;
 			case cb_res::wait_none: new_events = FD_CLOSE; break;
@@ -497,7 +1979,7 @@ bool to::socket_thread::task(int s, cb_arg& arg, const std::function<cb_res(cb_a
 		while (is_connected)
 		{
 			// Process callback result
-			switch (on_check(arg))
+			switch (check(on_check, arg))
 			{
 			case cb_res::terminate: return true;
 			case cb_res::wait_none: fds[0].events = 0; break;
@@ -551,7 +2033,8 @@ void to::socket_thread::start(const char* target, const char* port, const std::f
 			// Reconnection loop
 			while (m_state != thread_state::terminated)
 			{
-				int connection = make_socket(::socket(info->ai_family, info->ai_socktype, info->ai_protocol));
+				// Initiate connection
+				int connection = connect_socket(info);
 
 				if (connection == -1)
 				{
@@ -559,24 +2042,6 @@ void to::socket_thread::start(const char* target, const char* port, const std::f
 					break;
 				}
 
-				set_nonblocking(connection);
-				::setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, sock_opt<int>{1}, sizeof(int));
-
-				// Initiate connection
-				if (::connect(connection, info->ai_addr, static_cast<int>(info->ai_addrlen)) != 0)
-				{
-#ifdef _WIN32
-					if (WSAGetLastError() != WSAEWOULDBLOCK)
-#else
-					if (errno != EINPROGRESS && errno != EAGAIN)
-#endif
-					{
-						m_state = thread_state::terminated;
-						::close_socket(connection);
-						break;
-					}
-				}
-
 				// Enter main loop
 				if (!task(connection, arg, on_check))
 				{
@@ -615,8 +2080,99 @@ void to::socket_thread::start(int s, std::uint64_t time, const char* source, con
 	});
 }
 
+void to::socket_thread::start(socket_engine& engine, const char* target, const char* port, const std::function<cb_res(cb_arg&)>& on_check)
+{
+	terminate();
+
+	// Get addr info
+	struct ::addrinfo hints{};
+	struct ::addrinfo* info;
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_socktype = SOCK_STREAM;
+
+	while (int err = ::getaddrinfo(target, port, &hints, &info))
+	{
+		if (err != EAI_AGAIN)
+		{
+			return;
+		}
+	}
+
+	m_addr.assign(target);
+	m_port.assign(port);
+	m_is_client = true;
+	m_time = 0;
+	m_engine = &engine;
+
+	auto entry = std::make_shared<socket_engine::entry>();
+	entry->owner    = this;
+	entry->on_check = on_check;
+	entry->worker   = engine.m_next++ % engine.m_workers.size();
+	entry->info     = info;
+
+	m_state = thread_state::running;
+	std::atomic_store(&m_entry, entry);
+	engine.m_workers[entry->worker]->post(entry, command::add);
+}
+
+void to::socket_thread::start(socket_engine& engine, int s, std::uint64_t time, const char* source, const char* port, const std::function<cb_res(cb_arg&)>& on_check)
+{
+	terminate();
+	m_addr.assign(source);
+	m_port.assign(port);
+	m_is_client = false;
+	m_time = time;
+	m_socket = s;
+	m_engine = &engine;
+
+	auto entry = std::make_shared<socket_engine::entry>();
+	entry->owner     = this;
+	entry->on_check  = on_check;
+	entry->worker    = engine.m_next++ % engine.m_workers.size();
+	entry->sock      = s;
+	entry->connected = true;
+
+	m_state = thread_state::running;
+	std::atomic_store(&m_entry, entry);
+	engine.m_workers[entry->worker]->post(entry, command::add);
+}
+
 void to::socket_thread::terminate()
 {
+	if (const auto entry = std::atomic_load(&m_entry))
+	{
+		m_state = thread_state::terminated;
+
+		// Called from own callback: the engine will finish the connection after return
+		if (socket_engine::worker::t_current == entry.get())
+		{
+			return;
+		}
+
+		auto& worker = *m_engine->m_workers[entry->worker];
+
+		if (socket_engine::worker::t_worker == &worker)
+		{
+			// Called from another callback of the same worker
+			worker.release(entry);
+		}
+		else
+		{
+			worker.post(entry, command::release);
+
+			std::unique_lock<std::mutex> lock(worker.mutex);
+			worker.cv.wait(lock, [&] { return entry->owner == nullptr; });
+		}
+
+		std::atomic_store(&m_entry, std::shared_ptr<socket_engine::entry>());
+		m_engine = nullptr;
+		m_time = 0;
+		m_socket = -1;
+		m_timeout = -1;
+		m_state = thread_state::null;
+		return;
+	}
+
 	if (m_thread.joinable())
 	{
 		m_state = thread_state::terminated;
@@ -647,9 +2203,25 @@ void to::socket_thread::terminate()
 
 void to::socket_thread::signal()
 {
+	if (const auto entry = std::atomic_load(&m_entry))
+	{
+		m_engine->m_workers[entry->worker]->post(entry, command::signal);
+		return;
+	}
+
 #ifdef _WIN32
 	::WSASetEvent(m_event);
 #else
 	::write(m_pipe[1], "\1", 1);
 #endif
 }
+
+bool to::socket_thread::is_current() const
+{
+	if (const auto entry = std::atomic_load(&m_entry))
+	{
+		return socket_engine::worker::t_current == entry.get();
+	}
+
+	return std::this_thread::get_id() == m_thread.get_id();
+}
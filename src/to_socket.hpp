@@ -4,6 +4,9 @@
 #include <string>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
 #include <functional>
 
 using uchar = unsigned char;
@@ -19,6 +22,111 @@ namespace to
 	// Socket peek wrapper
 	int peek(int s, void* ptr, std::size_t size);
 
+	// Scatter-gather element
+	struct io_buf
+	{
+		const void* ptr;
+		std::size_t size;
+	};
+
+	// Socket scatter-gather send wrapper (single syscall, same results as send)
+	int sendv(int s, const io_buf* bufs, std::size_t count);
+
+	// Connection output queue: small writes are coalesced, large ones are referenced without copying
+	class send_queue final
+	{
+		struct segment
+		{
+			// Data start (own chunk or referenced data)
+			const uchar* ptr;
+
+			std::size_t size;
+
+			// Own chunk for coalesced writes (s_chunk bytes)
+			std::unique_ptr<uchar[]> chunk;
+
+			// Lifetime of referenced data
+			std::shared_ptr<const void> owner;
+		};
+
+		std::deque<segment> m_segs;
+
+		// Chunks for reuse
+		std::vector<std::unique_ptr<uchar[]>> m_free;
+
+		// Bytes already sent from the first segment
+		std::size_t m_offset = 0;
+
+		// Total bytes pending
+		std::size_t m_size = 0;
+
+	public:
+		// Coalescing chunk size
+		static constexpr std::size_t s_chunk = 16384;
+
+		// Smaller referenced writes are copied
+		static constexpr std::size_t s_min_ref = 4096;
+
+		// Max segments per syscall
+		static constexpr std::size_t s_max_iov = 64;
+
+		// Copy data
+		void write(const void* ptr, std::size_t size);
+
+		// Reference data (owner keeps it alive until sent)
+		void write(std::shared_ptr<const void> owner, const void* ptr, std::size_t size);
+
+		// Send as much as possible (returns bytes sent, 0 if blocked, or negative send result)
+		int flush(int s);
+
+		// Discard pending data
+		void clear();
+
+		std::size_t size() const
+		{
+			return m_size;
+		}
+
+		bool empty() const
+		{
+			return m_size == 0;
+		}
+	};
+
+	// Connection input buffer: received frames are accessed in place
+	class recv_buffer final
+	{
+		std::unique_ptr<uchar[]> m_data;
+
+		std::size_t m_cap;
+
+		// Unconsumed data range
+		std::size_t m_begin = 0;
+		std::size_t m_end = 0;
+
+	public:
+		explicit recv_buffer(std::size_t capacity = 65536);
+
+		// Receive into free space with single recv (returns recv result, 0 if blocked or buffer is full)
+		int fill(int s);
+
+		// Get next size bytes (nullptr if not received yet, then buffer is prepared to hold them)
+		const uchar* frame(std::size_t size);
+
+		// Remove size bytes from the front
+		void consume(std::size_t size);
+
+		const uchar* data() const
+		{
+			return m_data.get() + m_begin;
+		}
+
+		std::size_t size() const
+		{
+			return m_end - m_begin;
+		}
+	};
+
 	// Thread state
 	enum class thread_state
 	{
@@ -32,8 +140,11 @@ namespace to
 	// TCP server thread class
 	class server_thread final
 	{
-		// Server thread handle
-		std::thread m_thread;
+		// Listener thread with its own socket and readiness backend
+		struct shard;
+
+		// Server threads (more than one if accepts are sharded with SO_REUSEPORT)
+		std::vector<std::unique_ptr<shard>> m_shards;
 
 		// Server thread state
 		std::atomic<thread_state> m_state{};
@@ -45,13 +156,15 @@ namespace to
 
 		~server_thread();
 
-		void start(const char* bind_addr, const char* bind_port, const accept_func& on_accept);
+		// Start listening (shards > 1: separate listener thread per shard, if SO_REUSEPORT is supported)
+		// on_accept may be called concurrently from different shards
+		void start(const char* bind_addr, const char* bind_port, const accept_func& on_accept, std::size_t shards = 1);
 
 		void terminate();
 
 		explicit operator bool() const
 		{
-			return m_thread.joinable();
+			return !m_shards.empty();
 		}
 	};
 
@@ -76,12 +189,51 @@ namespace to
 		signal_both,
 	};
 
+	class socket_thread;
+
+	// Event-driven connection engine: fixed pool of I/O threads (epoll, kqueue or WSAPoll)
+	class socket_engine final
+	{
+		struct worker;
+
+		// Connection state
+		struct entry;
+
+		std::vector<std::unique_ptr<worker>> m_workers;
+
+		// Next worker for new connections (round-robin)
+		std::atomic<std::size_t> m_next{0};
+
+		friend class socket_thread;
+
+	public:
+		// Start I/O threads (0 = hardware concurrency)
+		explicit socket_engine(std::size_t threads = 0);
+
+		socket_engine(const socket_engine&) = delete;
+
+		// All connections must be terminated before engine destruction
+		~socket_engine();
+
+		// Get number of I/O threads
+		std::size_t size() const
+		{
+			return m_workers.size();
+		}
+	};
+
 	// TCP connection thread class
 	class socket_thread final
 	{
 		// Connection thread handle
 		std::thread m_thread;
 
+		// Connection engine (if not using own thread)
+		socket_engine* m_engine{};
+
+		// Connection state for the engine
+		std::shared_ptr<socket_engine::entry> m_entry;
+
 		std::string m_addr;
 		std::string m_port;
 
@@ -106,6 +258,8 @@ namespace to
 		// Internal thread task processing (returns false if connection failed or thread terminated)
 		bool task(int s, cb_arg& arg, const std::function<cb_res(cb_arg&)>& on_check);
 
+		friend class socket_engine;
+
 	public:
 		socket_thread();
 
@@ -113,7 +267,7 @@ namespace to
 
 		explicit operator bool() const
 		{
-			return m_thread.joinable();
+			return m_thread.joinable() || m_entry;
 		}
 
 		~socket_thread();
@@ -124,6 +278,12 @@ namespace to
 		// Proceed accepted connection (server)
 		void start(int s, std::uint64_t time, const char* source, const char* port, const std::function<cb_res(cb_arg&)>& on_check);
 
+		// Initiate connection using the engine (name resolution is done in the calling thread)
+		void start(socket_engine& engine, const char* target, const char* port, const std::function<cb_res(cb_arg&)>& on_check);
+
+		// Proceed accepted connection using the engine
+		void start(socket_engine& engine, int s, std::uint64_t time, const char* source, const char* port, const std::function<cb_res(cb_arg&)>& on_check);
+
 		// Ask the thread to terminate.
 		void terminate();
 
@@ -159,10 +319,8 @@ namespace to
 			return m_is_client;
 		}
 
-		bool is_current() const
-		{
-			return std::this_thread::get_id() == m_thread.get_id();
-		}
+		// Check whether called from the connection callback context
+		bool is_current() const;
 
 		void set_timeout(int ms)
 		{
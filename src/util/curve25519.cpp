@@ -15,6 +15,9 @@
 #include <string.h>
 #include <openssl/sha.h>
 #include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include "curve25519.hpp"
+#include "sfs.hpp"
 
 /* fe means field element. Here the field is \Z/(2^255-19). An element t,
  * entries t[0]...t[9], represents the integer t[0]+2^26 t[1]+2^51 t[2]+2^77
@@ -4671,6 +4674,226 @@ int ED25519_verify(const uint8_t *message, size_t message_len,
   return CRYPTO_memcmp(rcheck, rcopy, sizeof(rcheck)) == 0;
 }
 
+/* Ai = A, 3A, 5A, ..., 15A (for the sliding window) */
+static void ge_p3_odd_multiples(ge_cached Ai[8], const ge_p3 *A) {
+  ge_p1p1 t;
+  ge_p3 u;
+  ge_p3 A2;
+  int i;
+
+  ge_p3_to_cached(&Ai[0], A);
+  ge_p3_dbl(&t, A);
+  ge_p1p1_to_p3(&A2, &t);
+
+  for (i = 0; i < 7; ++i) {
+    ge_add(&t, &A2, &Ai[i]);
+    ge_p1p1_to_p3(&u, &t);
+    ge_p3_to_cached(&Ai[i + 1], &u);
+  }
+}
+
+/* Max number of signatures in a single multi-scalar multiplication */
+#define ED25519_BATCH 64
+
+/* Randomized batch check (Straus multi-scalar multiplication):
+ *   8 * (sum(z_i R_i) + sum((z_i h_i) A_i) - (sum(z_i s_i)) B) == 0
+ * with random odd 128-bit z_i. Returns 1 if every signature satisfies the
+ * cofactored verification equation, 0 if any doesn't or on error. For a
+ * single signature this is the exact cofactored check (z_1 is nonzero and
+ * smaller than the group order). */
+static int ed25519_verify_chunk(const uint8_t *const *messages,
+                                const size_t *message_lens,
+                                const uint8_t *const *signatures,
+                                const uint8_t *const *public_keys,
+                                size_t count) {
+  static const uint8_t kZeros[32] = {0};
+  uint8_t z[ED25519_BATCH][32];
+  uint8_t zh[32];
+  uint8_t S[32] = {0};
+  uint8_t h[SHA512_DIGEST_LENGTH];
+  uint8_t rcheck[32];
+  signed char bslide[256];
+  SHA512_CTX hash_ctx;
+  ge_cached(*table)[8];
+  signed char(*slides)[256];
+  ge_p3 A;
+  ge_p3 Rp;
+  ge_p3 u;
+  ge_p2 r;
+  ge_p1p1 t;
+  fe check;
+  size_t i;
+  size_t j;
+  int k;
+  int ok = 0;
+
+  /* Points R_i and A_i are interleaved */
+  table = (ge_cached(*)[8])OPENSSL_malloc(sizeof(*table) * count * 2);
+  slides = (signed char(*)[256])OPENSSL_malloc(sizeof(*slides) * count * 2);
+
+  if (table == NULL || slides == NULL) {
+    goto end;
+  }
+
+  memset(z, 0, sizeof(z));
+
+  for (i = 0; i < count; ++i) {
+    if (RAND_bytes(z[i], 16) != 1) {
+      goto end;
+    }
+
+    z[i][0] |= 1;
+  }
+
+  for (i = 0; i < count; ++i) {
+    const uint8_t *signature = signatures[i];
+
+    if ((signature[63] & 224) != 0 ||
+        ge_frombytes_vartime(&A, public_keys[i]) != 0 ||
+        ge_frombytes_vartime(&Rp, signature) != 0) {
+      goto end;
+    }
+
+    /* Only canonical R can match the encoding checked by ED25519_verify */
+    fe_tobytes(rcheck, Rp.Y);
+    rcheck[31] ^= fe_isnegative(Rp.X) << 7;
+
+    if (CRYPTO_memcmp(rcheck, signature, 32) != 0) {
+      goto end;
+    }
+
+    SHA512_Init(&hash_ctx);
+    SHA512_Update(&hash_ctx, signature, 32);
+    SHA512_Update(&hash_ctx, public_keys[i], 32);
+    SHA512_Update(&hash_ctx, messages[i], message_lens[i]);
+    SHA512_Final(h, &hash_ctx);
+
+    x25519_sc_reduce(h);
+
+    sc_muladd(zh, z[i], h, kZeros);
+    sc_muladd(S, z[i], signature + 32, S);
+
+    slide(slides[i * 2 + 0], z[i]);
+    slide(slides[i * 2 + 1], zh);
+    ge_p3_odd_multiples(table[i * 2 + 0], &Rp);
+    ge_p3_odd_multiples(table[i * 2 + 1], &A);
+  }
+
+  slide(bslide, S);
+
+  /* Shared doublings, additions for every point (the base point is subtracted) */
+  ge_p2_0(&r);
+
+  for (k = 255; k >= 0; --k) {
+    ge_p2_dbl(&t, &r);
+
+    for (j = 0; j < count * 2; ++j) {
+      const signed char e = slides[j][k];
+
+      if (e > 0) {
+        ge_p1p1_to_p3(&u, &t);
+        ge_add(&t, &u, &table[j][e / 2]);
+      } else if (e < 0) {
+        ge_p1p1_to_p3(&u, &t);
+        ge_sub(&t, &u, &table[j][(-e) / 2]);
+      }
+    }
+
+    if (bslide[k] > 0) {
+      ge_p1p1_to_p3(&u, &t);
+      ge_msub(&t, &u, &Bi[bslide[k] / 2]);
+    } else if (bslide[k] < 0) {
+      ge_p1p1_to_p3(&u, &t);
+      ge_madd(&t, &u, &Bi[(-bslide[k]) / 2]);
+    }
+
+    ge_p1p1_to_p2(&r, &t);
+  }
+
+  /* Multiply by the cofactor and check for the identity (0, 1) */
+  for (k = 0; k < 3; ++k) {
+    ge_p2_dbl(&t, &r);
+    ge_p1p1_to_p2(&r, &t);
+  }
+
+  fe_sub(check, r.Y, r.Z);
+  ok = !fe_isnonzero(r.X) && !fe_isnonzero(check);
+
+end:
+  OPENSSL_free(table);
+  OPENSSL_free(slides);
+  return ok;
+}
+
+/* Verify chunk, find invalid signatures one by one if the batch fails
+ * (with the same cofactored equation, so results don't depend on the
+ * batch size or on the other signatures in the chunk) */
+static int ed25519_verify_batch_chunk(const uint8_t *const *messages,
+                                      const size_t *message_lens,
+                                      const uint8_t *const *signatures,
+                                      const uint8_t *const *public_keys,
+                                      size_t count, int *results) {
+  size_t i;
+  int ok = 1;
+
+  if (ed25519_verify_chunk(messages, message_lens, signatures, public_keys,
+                           count)) {
+    for (i = 0; i < count; ++i) {
+      results[i] = 1;
+    }
+
+    return 1;
+  }
+
+  for (i = 0; i < count; ++i) {
+    results[i] = count > 1 &&
+                 ed25519_verify_chunk(messages + i, message_lens + i,
+                                      signatures + i, public_keys + i, 1);
+    ok &= results[i];
+  }
+
+  return ok;
+}
+
+int ED25519_verify_batch(const uint8_t *const *messages,
+                         const size_t *message_lens,
+                         const uint8_t *const *signatures,
+                         const uint8_t *const *public_keys, size_t count,
+                         int *results) {
+  const size_t chunks = (count + ED25519_BATCH - 1) / ED25519_BATCH;
+  int *res = results;
+  int ok = 1;
+  size_t i;
+
+  if (res == NULL) {
+    res = (int *)OPENSSL_malloc(sizeof(int) * (count ? count : 1));
+
+    if (res == NULL) {
+      return 0;
+    }
+  }
+
+  /* Chunks are distributed between the shared crypto threads */
+  sfs::run_parallel(chunks, [&](size_t c) {
+    const size_t begin = c * ED25519_BATCH;
+    const size_t n = count - begin < ED25519_BATCH ? count - begin : ED25519_BATCH;
+
+    ed25519_verify_batch_chunk(messages + begin, message_lens + begin,
+                               signatures + begin, public_keys + begin, n,
+                               res + begin);
+  });
+
+  for (i = 0; i < count; ++i) {
+    ok &= res[i];
+  }
+
+  if (res != results) {
+    OPENSSL_free(res);
+  }
+
+  return ok;
+}
+
 void ED25519_public_from_private(uint8_t out_public_key[32],
                                  const uint8_t private_key[32]) {
   uint8_t az[SHA512_DIGEST_LENGTH];
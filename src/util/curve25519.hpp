@@ -1,11 +1,21 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 int ED25519_sign(uint8_t *out_sig, const uint8_t *message, size_t message_len,
 	const uint8_t public_key[32], const uint8_t private_key[32]);
 int ED25519_verify(const uint8_t *message, size_t message_len,
 	const uint8_t signature[64], const uint8_t public_key[32]);
+
+// Verify many signatures with randomized batch verification (large batches are split between threads).
+// Every signature is checked with the cofactored equation, regardless of the batch size and contents:
+// a signature specially crafted by the key owner to differ from a valid one by a small-order component
+// is accepted, unlike ED25519_verify.
+// results[i] (optional) receives the result for each signature, returns 1 if all are valid.
+int ED25519_verify_batch(const uint8_t *const *messages, const size_t *message_lens,
+	const uint8_t *const *signatures, const uint8_t *const *public_keys, size_t count,
+	int *results);
 void ED25519_public_from_private(uint8_t out_public_key[32],
 	const uint8_t private_key[32]);
 
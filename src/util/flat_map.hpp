@@ -0,0 +1,493 @@
+#pragma once
+
+// Open-addressing hash map with stable item addresses, implements a subset of std::unordered_map interface.
+// Items are stored in insertion order in fixed-size chunks (no allocation per item, fast iteration).
+// Index is a flat array of 8-byte slots (32-bit hash tag and item number) with linear probing,
+// so probing compares keys only when the tags match and a lookup usually touches two cache lines.
+
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+
+namespace ssdb
+{
+	template <typename K, typename T, typename H = std::hash<K>, typename E = std::equal_to<K>>
+	class flat_map final
+	{
+	public:
+		using key_type = K;
+		using mapped_type = T;
+		using value_type = std::pair<const K, T>;
+		using size_type = std::size_t;
+
+	private:
+		// Number of items in a chunk
+		static constexpr std::uint32_t s_chunk = 256;
+
+		// Special item numbers in the index
+		static constexpr std::uint32_t s_empty = -1;
+		static constexpr std::uint32_t s_deleted = -2;
+
+		// Not found in the index
+		static constexpr std::size_t s_npos = -1;
+
+		struct slot
+		{
+			std::uint32_t tag;
+			std::uint32_t item;
+		};
+
+		using storage = std::aligned_storage_t<sizeof(value_type), alignof(value_type)>;
+
+		// Item storage, never moved
+		std::vector<std::unique_ptr<storage[]>> m_chunks;
+
+		// Constructed items
+		std::vector<bool> m_live;
+
+		// Erased item numbers for reuse
+		std::vector<std::uint32_t> m_freed;
+
+		// Index
+		std::unique_ptr<slot[]> m_slots;
+
+		// Index capacity (power of 2 or 0)
+		std::size_t m_cap = 0;
+
+		// Shift to get the start position from the mixed hash
+		unsigned m_shift = 64;
+
+		// Number of items
+		std::size_t m_size = 0;
+
+		// Number of deleted slots
+		std::size_t m_deleted = 0;
+
+		H m_hash;
+		E m_eq;
+
+		value_type* get(std::uint32_t n) const
+		{
+			return reinterpret_cast<value_type*>(&m_chunks[n / s_chunk][n % s_chunk]);
+		}
+
+		// Improve weak hashes (such as identity), start position is taken from the upper bits
+		std::uint64_t mix(const K& key) const
+		{
+			return static_cast<std::uint64_t>(m_hash(key)) * 0x9e3779b97f4a7c15ull;
+		}
+
+		static std::uint32_t tag(std::uint64_t h)
+		{
+			return static_cast<std::uint32_t>(h ^ (h >> 32));
+		}
+
+		// Find index position of the key
+		std::size_t lookup(const K& key, std::uint64_t h) const
+		{
+			if (!m_cap)
+			{
+				return s_npos;
+			}
+
+			const std::uint32_t t = tag(h);
+
+			for (std::size_t pos = static_cast<std::size_t>(h >> m_shift);; pos = (pos + 1) & (m_cap - 1))
+			{
+				const slot& s = m_slots[pos];
+
+				if (s.item == s_empty)
+				{
+					return s_npos;
+				}
+
+				if (s.tag == t && s.item != s_deleted && m_eq(get(s.item)->first, key))
+				{
+					return pos;
+				}
+			}
+		}
+
+		// Add item to the index (capacity must be sufficient)
+		void place(std::uint64_t h, std::uint32_t n)
+		{
+			std::size_t pos = static_cast<std::size_t>(h >> m_shift);
+
+			while (m_slots[pos].item != s_empty && m_slots[pos].item != s_deleted)
+			{
+				pos = (pos + 1) & (m_cap - 1);
+			}
+
+			if (m_slots[pos].item == s_deleted)
+			{
+				m_deleted--;
+			}
+
+			m_slots[pos].tag = tag(h);
+			m_slots[pos].item = n;
+		}
+
+		// Rebuild the index with the capacity for at least count items (max load factor is 7/8)
+		void rehash(std::size_t count)
+		{
+			std::size_t cap = 16;
+			unsigned shift = 60;
+
+			while (cap * 7 < count * 16)
+			{
+				cap *= 2;
+				shift--;
+			}
+
+			m_slots.reset(new slot[cap]);
+			m_cap = cap;
+			m_shift = shift;
+			m_deleted = 0;
+
+			for (std::size_t i = 0; i < cap; i++)
+			{
+				m_slots[i] = {0, s_empty};
+			}
+
+			for (std::uint32_t n = 0; n < m_live.size(); n++)
+			{
+				if (m_live[n])
+				{
+					place(mix(get(n)->first), n);
+				}
+			}
+		}
+
+		// Get item number for a new item
+		std::uint32_t alloc()
+		{
+			if (!m_freed.empty())
+			{
+				const std::uint32_t n = m_freed.back();
+				m_freed.pop_back();
+				return n;
+			}
+
+			const std::uint32_t n = static_cast<std::uint32_t>(m_live.size());
+
+			if (n % s_chunk == 0)
+			{
+				m_chunks.emplace_back(new storage[s_chunk]);
+			}
+
+			m_live.push_back(false);
+			return n;
+		}
+
+		template <bool Const>
+		class basic_iterator
+		{
+			using map_type = std::conditional_t<Const, const flat_map, flat_map>;
+			using item_type = std::conditional_t<Const, const value_type, value_type>;
+
+			map_type* m_map;
+
+			std::uint32_t m_pos;
+
+			friend class flat_map;
+
+			template <bool>
+			friend class basic_iterator;
+
+		public:
+			basic_iterator(map_type* map, std::uint32_t pos)
+				: m_map(map)
+				, m_pos(pos)
+			{
+			}
+
+			// Non-const to const conversion
+			basic_iterator(const basic_iterator<false>& it)
+				: m_map(it.m_map)
+				, m_pos(it.m_pos)
+			{
+			}
+
+			bool operator ==(const basic_iterator& rhs) const
+			{
+				return m_pos == rhs.m_pos;
+			}
+
+			bool operator !=(const basic_iterator& rhs) const
+			{
+				return m_pos != rhs.m_pos;
+			}
+
+			item_type& operator *() const
+			{
+				return *m_map->get(m_pos);
+			}
+
+			item_type* operator ->() const
+			{
+				return m_map->get(m_pos);
+			}
+
+			basic_iterator& operator ++()
+			{
+				const std::uint32_t end = static_cast<std::uint32_t>(m_map->m_live.size());
+
+				while (++m_pos < end && !m_map->m_live[m_pos])
+				{
+				}
+
+				return *this;
+			}
+		};
+
+		// Get first live item number starting from n
+		std::uint32_t skip(std::uint32_t n) const
+		{
+			while (n < m_live.size() && !m_live[n])
+			{
+				n++;
+			}
+
+			return n;
+		}
+
+	public:
+		using iterator = basic_iterator<false>;
+		using const_iterator = basic_iterator<true>;
+
+	private:
+		// Insert the key with the mapped value constructed from the tuple if not present
+		template <typename KK, typename Tuple>
+		std::pair<iterator, bool> emplace_key(KK&& key, Tuple&& args)
+		{
+			const std::uint64_t h = mix(key);
+			const std::size_t found = lookup(key, h);
+
+			if (found != s_npos)
+			{
+				return {iterator(this, m_slots[found].item), false};
+			}
+
+			// Count deleted slots as used to guarantee empty ones for probing
+			if ((m_size + m_deleted + 1) * 8 > m_cap * 7)
+			{
+				rehash(m_size + 1);
+			}
+
+			const std::uint32_t n = alloc();
+
+			try
+			{
+				new (get(n)) value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)), std::forward<Tuple>(args));
+			}
+			catch (...)
+			{
+				m_freed.push_back(n);
+				throw;
+			}
+
+			m_live[n] = true;
+			place(h, n);
+			m_size++;
+			return {iterator(this, n), true};
+		}
+
+	public:
+
+		flat_map() = default;
+
+		flat_map(const flat_map&) = delete;
+
+		flat_map& operator =(const flat_map&) = delete;
+
+		~flat_map()
+		{
+			clear();
+		}
+
+		std::size_t size() const
+		{
+			return m_size;
+		}
+
+		bool empty() const
+		{
+			return m_size == 0;
+		}
+
+		// Ensure no rehashing until the size reaches count
+		void reserve(std::size_t count)
+		{
+			if (count * 8 > m_cap * 7)
+			{
+				rehash(count);
+			}
+		}
+
+		void clear()
+		{
+			for (std::uint32_t n = 0; n < m_live.size(); n++)
+			{
+				if (m_live[n])
+				{
+					get(n)->~value_type();
+				}
+			}
+
+			m_chunks.clear();
+			m_live.clear();
+			m_freed.clear();
+			m_slots.reset();
+			m_cap = 0;
+			m_shift = 64;
+			m_size = 0;
+			m_deleted = 0;
+		}
+
+		// Construct value_type from args, stored item is never moved until erased
+		// The item is constructed before the key lookup unless the key is given separately (piecewise or try_emplace)
+		template <typename... Args>
+		std::pair<iterator, bool> emplace(Args&&... args)
+		{
+			const std::uint32_t n = alloc();
+
+			value_type* item;
+
+			try
+			{
+				item = new (get(n)) value_type(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				m_freed.push_back(n);
+				throw;
+			}
+
+			const std::uint64_t h = mix(item->first);
+			const std::size_t found = lookup(item->first, h);
+
+			if (found != s_npos)
+			{
+				item->~value_type();
+				m_freed.push_back(n);
+				return {iterator(this, m_slots[found].item), false};
+			}
+
+			// Count deleted slots as used to guarantee empty ones for probing
+			if ((m_size + m_deleted + 1) * 8 > m_cap * 7)
+			{
+				try
+				{
+					rehash(m_size + 1);
+				}
+				catch (...)
+				{
+					// Not live yet, so clear() wouldn't destroy it
+					item->~value_type();
+					m_freed.push_back(n);
+					throw;
+				}
+			}
+
+			m_live[n] = true;
+			place(h, n);
+			m_size++;
+			return {iterator(this, n), true};
+		}
+
+		// Look up the key first, construct the value only if inserting
+		template <typename KA, typename... Args>
+		std::pair<iterator, bool> emplace(std::piecewise_construct_t, std::tuple<KA> key, std::tuple<Args...> args)
+		{
+			return emplace_key(std::forward<KA>(std::get<0>(key)), std::move(args));
+		}
+
+		template <typename... Args>
+		std::pair<iterator, bool> try_emplace(const K& key, Args&&... args)
+		{
+			return emplace_key(key, std::forward_as_tuple(std::forward<Args>(args)...));
+		}
+
+		template <typename... Args>
+		std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+		{
+			return emplace_key(std::move(key), std::forward_as_tuple(std::forward<Args>(args)...));
+		}
+
+		void erase(const_iterator it)
+		{
+			const std::uint32_t n = it.m_pos;
+			const std::size_t pos = lookup(get(n)->first, mix(get(n)->first));
+
+			// Can become empty if it doesn't break a probe sequence
+			if (m_slots[(pos + 1) & (m_cap - 1)].item == s_empty)
+			{
+				m_slots[pos].item = s_empty;
+			}
+			else
+			{
+				m_slots[pos].item = s_deleted;
+				m_deleted++;
+			}
+
+			get(n)->~value_type();
+			m_live[n] = false;
+			m_freed.push_back(n);
+			m_size--;
+		}
+
+		iterator find(const K& key)
+		{
+			const std::size_t found = lookup(key, mix(key));
+
+			return iterator(this, found == s_npos ? static_cast<std::uint32_t>(m_live.size()) : m_slots[found].item);
+		}
+
+		const_iterator find(const K& key) const
+		{
+			const std::size_t found = lookup(key, mix(key));
+
+			return const_iterator(this, found == s_npos ? static_cast<std::uint32_t>(m_live.size()) : m_slots[found].item);
+		}
+
+		std::size_t count(const K& key) const
+		{
+			return lookup(key, mix(key)) != s_npos;
+		}
+
+		iterator begin()
+		{
+			return iterator(this, skip(0));
+		}
+
+		iterator end()
+		{
+			return iterator(this, static_cast<std::uint32_t>(m_live.size()));
+		}
+
+		const_iterator begin() const
+		{
+			return const_iterator(this, skip(0));
+		}
+
+		const_iterator end() const
+		{
+			return const_iterator(this, static_cast<std::uint32_t>(m_live.size()));
+		}
+
+		const_iterator cbegin() const
+		{
+			return begin();
+		}
+
+		const_iterator cend() const
+		{
+			return end();
+		}
+	};
+}
@@ -4,9 +4,17 @@
 #include <memory>
 #include <utility>
 #include <cstdint>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
 
 namespace lfs
 {
+	template <typename T>
+	class list_pool;
+
 	template <typename T>
 	class list_item final
 	{
@@ -17,6 +25,9 @@ namespace lfs
 		template <typename TT>
 		friend class list;
 
+		template <typename TT>
+		friend class list_pool;
+
 	public:
 		constexpr list_item() = default;
 
@@ -54,6 +65,101 @@ namespace lfs
 		}
 	};
 
+	// Storage pool for list_item<T> (items consumed by list::apply are reused by list::push).
+	// Producers take all returned items at once into a thread-local cache, so there is no ABA problem.
+	template <typename T>
+	class list_pool final
+	{
+		// Unused item storage
+		struct node
+		{
+			node* next;
+		};
+
+		// Pool owner (frees remaining storage on exit)
+		struct chain
+		{
+			std::atomic<node*> head{};
+
+			~chain()
+			{
+				for (node* ptr = head.load(); ptr;)
+				{
+					::operator delete(std::exchange(ptr, ptr->next));
+				}
+			}
+		};
+
+		static chain& shared()
+		{
+			static chain s_chain;
+			return s_chain;
+		}
+
+		static chain& local()
+		{
+			static thread_local chain s_cache;
+			return s_cache;
+		}
+
+	public:
+		// Items are allocated with plain operator new, so pooled items are compatible with delete
+		static constexpr bool enabled = alignof(list_item<T>) <= alignof(std::max_align_t);
+
+		// Get storage for a new item (may return nullptr)
+		static void* take()
+		{
+			chain& cache = local();
+			node* ptr = cache.head.load(std::memory_order_relaxed);
+
+			if (!ptr && shared().head.load(std::memory_order_relaxed))
+			{
+				ptr = shared().head.exchange(nullptr, std::memory_order_acquire);
+			}
+
+			if (ptr)
+			{
+				cache.head.store(ptr->next, std::memory_order_relaxed);
+			}
+
+			return ptr;
+		}
+
+		// Destroy item and return its storage (items must be unlinked)
+		static void give(list_item<T>* item, list_item<T>*& first, list_item<T>*& last)
+		{
+			item->~list_item();
+			node* ptr = new (item) node{nullptr};
+
+			if (last)
+			{
+				reinterpret_cast<node*>(last)->next = ptr;
+			}
+			else
+			{
+				first = item;
+			}
+
+			last = item;
+		}
+
+		// Return storage collected with give()
+		static void give_all(list_item<T>* first, list_item<T>* last)
+		{
+			if (first)
+			{
+				chain& pool = shared();
+				node* old = pool.head.load(std::memory_order_relaxed);
+				reinterpret_cast<node*>(last)->next = old;
+
+				while (!pool.head.compare_exchange_weak(old, reinterpret_cast<node*>(first), std::memory_order_release, std::memory_order_relaxed))
+				{
+					reinterpret_cast<node*>(last)->next = old;
+				}
+			}
+		}
+	};
+
 	template <typename T>
 	class list
 	{
@@ -68,15 +174,28 @@ namespace lfs
 			delete m_head.load(std::memory_order_relaxed);
 		}
 
+		// Add element (returns true if the list was empty, so the consumer may need a signal)
 		template <typename... Args>
-		void push(Args&&... args)
+		bool push(Args&&... args)
 		{
 			list_item<T>* old = m_head.load();
-			list_item<T>* item = new list_item<T>(old, std::forward<Args>(args)...);
+			list_item<T>* item;
+
+			if (void* ptr = list_pool<T>::enabled ? list_pool<T>::take() : nullptr)
+			{
+				item = new (ptr) list_item<T>(old, std::forward<Args>(args)...);
+			}
+			else
+			{
+				item = new list_item<T>(old, std::forward<Args>(args)...);
+			}
+
 			while (!m_head.compare_exchange_strong(old, item))
 			{
 				item->m_link = old;
 			}
+
+			return old == nullptr;
 		}
 
 		// Withdraw the list
@@ -107,13 +226,241 @@ namespace lfs
 					while (prev);
 				}
 
-				for (std::unique_ptr<list_item<T>> ptr(head); ptr; ptr = ptr->pop_all(), count++)
+				// Storage of processed items is returned to the pool (also if func throws)
+				struct collected
+				{
+					list_item<T>* first = nullptr;
+					list_item<T>* last = nullptr;
+
+					~collected()
+					{
+						list_pool<T>::give_all(first, last);
+					}
+				} pool;
+
+				for (std::unique_ptr<list_item<T>> ptr(head); ptr; count++)
 				{
+					std::unique_ptr<list_item<T>> next = ptr->pop_all();
 					func(ptr->m_data);
+
+					if (list_pool<T>::enabled)
+					{
+						list_pool<T>::give(ptr.release(), pool.first, pool.last);
+					}
+
+					ptr = std::move(next);
 				}
 			}
 
 			return count;
 		}
 	};
+
+	// Bounded lock-free MPMC queue (ring buffer of sequenced cells), no allocation after construction
+	template <typename T>
+	class ring final
+	{
+		struct cell
+		{
+			std::atomic<std::size_t> seq;
+
+			std::aligned_storage_t<sizeof(T), alignof(T)> data;
+		};
+
+		const std::unique_ptr<cell[]> m_cells;
+
+		const std::size_t m_mask;
+
+		// Producer and consumer positions (on separate cache lines)
+		alignas(64) std::atomic<std::size_t> m_push{0};
+		alignas(64) std::atomic<std::size_t> m_pop{0};
+
+		// Set by push_notify, cleared by the consumer before draining
+		alignas(64) std::atomic<bool> m_pending{false};
+
+		// Blocked consumers (for wait())
+		std::atomic<std::size_t> m_waiters{0};
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+
+		static std::size_t round_up(std::size_t size)
+		{
+			std::size_t cap = 2;
+
+			while (cap < size)
+			{
+				cap *= 2;
+			}
+
+			return cap;
+		}
+
+		// Claim the next element and call func(T&) before releasing the cell
+		template <typename F>
+		bool take(F&& func)
+		{
+			std::size_t pos = m_pop.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				cell& c = m_cells[pos & m_mask];
+				const std::size_t seq = c.seq.load(std::memory_order_acquire);
+				const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+
+				if (diff == 0)
+				{
+					if (m_pop.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						T& value = *reinterpret_cast<T*>(&c.data);
+						func(value);
+						value.~T();
+						c.seq.store(pos + m_mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = m_pop.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+	public:
+		// Capacity is rounded up to a power of 2
+		explicit ring(std::size_t capacity)
+			: m_cells(new cell[round_up(capacity)])
+			, m_mask(round_up(capacity) - 1)
+		{
+			for (std::size_t i = 0; i <= m_mask; i++)
+			{
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		ring(const ring&) = delete;
+
+		~ring()
+		{
+			while (take([](T&) {}))
+			{
+			}
+		}
+
+		std::size_t capacity() const
+		{
+			return m_mask + 1;
+		}
+
+		// Check if empty (approximate if used concurrently)
+		bool empty() const
+		{
+			const std::size_t pos = m_pop.load(std::memory_order_relaxed);
+			return m_cells[pos & m_mask].seq.load(std::memory_order_acquire) != pos + 1;
+		}
+
+		// Add element (returns false if full)
+		template <typename... Args>
+		bool push(Args&&... args)
+		{
+			std::size_t pos = m_push.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				cell& c = m_cells[pos & m_mask];
+				const std::size_t seq = c.seq.load(std::memory_order_acquire);
+				const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - pos);
+
+				if (diff == 0)
+				{
+					if (m_push.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						new (&c.data) T(std::forward<Args>(args)...);
+						c.seq.store(pos + 1, std::memory_order_release);
+						break;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = m_push.load(std::memory_order_relaxed);
+				}
+			}
+
+			// Wake blocked consumers
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (m_waiters.load(std::memory_order_relaxed))
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_cv.notify_all();
+			}
+
+			return true;
+		}
+
+		// Add element and call notify() if the consumer wasn't notified since its last apply()
+		// For example, notify = [&] { thread.signal(); } for a consumer draining the queue in its callback
+		template <typename F, typename... Args>
+		bool push_notify(F&& notify, Args&&... args)
+		{
+			if (!push(std::forward<Args>(args)...))
+			{
+				return false;
+			}
+
+			if (!m_pending.load(std::memory_order_relaxed) && !m_pending.exchange(true))
+			{
+				notify();
+			}
+
+			return true;
+		}
+
+		// Remove one element
+		bool pop(T& out)
+		{
+			return take([&](T& value)
+			{
+				out = std::move(value);
+			});
+		}
+
+		// Remove up to max elements in FIFO order and apply func(data) to each in place
+		template <typename F>
+		std::size_t apply(F&& func, std::size_t max = -1)
+		{
+			m_pending.exchange(false);
+
+			std::size_t count = 0;
+
+			while (count < max && take(func))
+			{
+				count++;
+			}
+
+			return count;
+		}
+
+		// Block until not empty (for consumers without an event loop)
+		void wait()
+		{
+			if (!empty())
+			{
+				return;
+			}
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_waiters++;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			m_cv.wait(lock, [&] { return !empty(); });
+			m_waiters--;
+		}
+	};
 }
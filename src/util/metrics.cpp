@@ -0,0 +1,165 @@
+#include "metrics.hpp"
+
+#ifdef TO_METRICS
+#include <mutex>
+#include <cstdio>
+
+namespace
+{
+	// Registered metrics (never removed)
+	std::mutex& registry_mutex()
+	{
+		static std::mutex s_mutex;
+		return s_mutex;
+	}
+
+	metrics::metric*& registry_head()
+	{
+		static metrics::metric* s_head = nullptr;
+		return s_head;
+	}
+
+	void append_value(std::string& out, const char* name, const char* suffix, const char* labels, double value)
+	{
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%.17g", value);
+
+		out += name;
+		out += suffix;
+		out += labels;
+		out += ' ';
+		out += buf;
+		out += '\n';
+	}
+}
+
+std::atomic<metrics::trace_sink> metrics::g_trace{nullptr};
+
+constexpr std::size_t metrics::histogram::s_buckets;
+
+metrics::metric::metric(const char* name, const char* help, kind type)
+	: m_name(name)
+	, m_help(help)
+	, m_kind(type)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex());
+	m_next = registry_head();
+	registry_head() = this;
+}
+
+std::uint64_t metrics::counter::value() const
+{
+	std::uint64_t result = 0;
+
+	for (auto& s : m_slots)
+	{
+		result += s.value.load(std::memory_order_relaxed);
+	}
+
+	return result;
+}
+
+std::uint64_t metrics::histogram::count() const
+{
+	std::uint64_t result = 0;
+
+	for (auto& s : m_slots)
+	{
+		for (auto& c : s.count)
+		{
+			result += c.load(std::memory_order_relaxed);
+		}
+	}
+
+	return result;
+}
+
+std::uint64_t metrics::histogram::sum() const
+{
+	std::uint64_t result = 0;
+
+	for (auto& s : m_slots)
+	{
+		result += s.sum.load(std::memory_order_relaxed);
+	}
+
+	return result;
+}
+
+void metrics::set_trace(trace_sink sink)
+{
+	g_trace = sink;
+}
+
+std::string metrics::prometheus()
+{
+	std::string out;
+
+	std::lock_guard<std::mutex> lock(registry_mutex());
+
+	for (metric* m = registry_head(); m; m = m->m_next)
+	{
+		out += "# HELP ";
+		out += m->m_name;
+		out += ' ';
+		out += m->m_help;
+		out += "\n# TYPE ";
+		out += m->m_name;
+
+		switch (m->m_kind)
+		{
+		case metric::kind::counter:
+		{
+			out += " counter\n";
+			append_value(out, m->m_name, "", "", static_cast<double>(static_cast<counter*>(m)->value()));
+			break;
+		}
+		case metric::kind::gauge:
+		{
+			out += " gauge\n";
+			append_value(out, m->m_name, "", "", static_cast<double>(static_cast<gauge*>(m)->value()));
+			break;
+		}
+		case metric::kind::flags:
+		{
+			out += " gauge\n";
+			append_value(out, m->m_name, "", "", static_cast<double>(static_cast<flags*>(m)->value()));
+			break;
+		}
+		case metric::kind::histogram:
+		{
+			out += " histogram\n";
+
+			const auto h = static_cast<histogram*>(m);
+
+			// Cumulative bucket counts (inclusive upper bound of bucket b is 2^b - 1)
+			std::uint64_t total = 0;
+
+			for (std::size_t b = 0; b < histogram::s_buckets; b++)
+			{
+				for (auto& s : h->m_slots)
+				{
+					total += s.count[b].load(std::memory_order_relaxed);
+				}
+
+				char labels[64];
+				std::snprintf(labels, sizeof(labels), "{le=\"%.17g\"}", static_cast<double>((1ull << b) - 1) * h->m_scale);
+				append_value(out, m->m_name, "_bucket", labels, static_cast<double>(total));
+			}
+
+			for (auto& s : h->m_slots)
+			{
+				total += s.count[histogram::s_buckets].load(std::memory_order_relaxed);
+			}
+
+			append_value(out, m->m_name, "_bucket", "{le=\"+Inf\"}", static_cast<double>(total));
+			append_value(out, m->m_name, "_sum", "", static_cast<double>(h->sum()) * h->m_scale);
+			append_value(out, m->m_name, "_count", "", static_cast<double>(total));
+			break;
+		}
+		}
+	}
+
+	return out;
+}
+#endif
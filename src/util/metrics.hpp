@@ -0,0 +1,339 @@
+#pragma once
+
+// Low-overhead instrumentation: counters, gauges and histograms aggregated on demand.
+// Counters and histograms are split into per-thread shards (relaxed atomics, no sharing on hot paths).
+// Metrics must have static storage duration, they are registered for export on construction.
+// Enabled by defining TO_METRICS, otherwise all classes are empty and calls compile to nothing.
+
+#include <string>
+#include <cstdint>
+
+#ifdef TO_METRICS
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace metrics
+{
+	// Trace span receiver (name, start and duration in ns of steady_clock)
+	using trace_sink = void (*)(const char* name, std::uint64_t start, std::uint64_t duration);
+
+#ifdef TO_METRICS
+	// Number of shards per metric
+	constexpr std::size_t s_shards = 16;
+
+	// Get shard index of the current thread
+	inline std::size_t shard()
+	{
+		static std::atomic<std::size_t> s_next{0};
+		static thread_local const std::size_t t_shard = s_next++ % s_shards;
+		return t_shard;
+	}
+
+	inline std::uint64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	class metric
+	{
+	public:
+		enum class kind
+		{
+			counter,
+			gauge,
+			flags,
+			histogram,
+		};
+
+	protected:
+		const char* const m_name;
+		const char* const m_help;
+		const kind m_kind;
+
+		// Registration list
+		metric* m_next;
+
+		metric(const char* name, const char* help, kind type);
+
+		metric(const metric&) = delete;
+
+		~metric() = default;
+
+		friend std::string prometheus();
+
+	public:
+		const char* name() const
+		{
+			return m_name;
+		}
+	};
+
+	// Monotonic counter
+	class counter final : public metric
+	{
+		struct alignas(64) slot
+		{
+			std::atomic<std::uint64_t> value{0};
+		};
+
+		slot m_slots[s_shards];
+
+	public:
+		counter(const char* name, const char* help)
+			: metric(name, help, kind::counter)
+		{
+		}
+
+		void add(std::uint64_t value = 1)
+		{
+			m_slots[shard()].value.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		std::uint64_t value() const;
+	};
+
+	// Current value (not sharded)
+	class gauge final : public metric
+	{
+		std::atomic<std::int64_t> m_value{0};
+
+	public:
+		gauge(const char* name, const char* help)
+			: metric(name, help, kind::gauge)
+		{
+		}
+
+		void add(std::int64_t value)
+		{
+			m_value.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		void set(std::int64_t value)
+		{
+			m_value.store(value, std::memory_order_relaxed);
+		}
+
+		std::int64_t value() const
+		{
+			return m_value.load(std::memory_order_relaxed);
+		}
+	};
+
+	// Set of bits ever raised (exported as gauge)
+	class flags final : public metric
+	{
+		std::atomic<std::uint64_t> m_value{0};
+
+	public:
+		flags(const char* name, const char* help)
+			: metric(name, help, kind::flags)
+		{
+		}
+
+		void raise(std::uint64_t bits)
+		{
+			if ((m_value.load(std::memory_order_relaxed) & bits) != bits)
+			{
+				m_value.fetch_or(bits, std::memory_order_relaxed);
+			}
+		}
+
+		std::uint64_t value() const
+		{
+			return m_value.load(std::memory_order_relaxed);
+		}
+	};
+
+	// Histogram with power of 2 buckets (bucket n counts values below 2^n, larger values are only counted in total)
+	class histogram final : public metric
+	{
+	public:
+		static constexpr std::size_t s_buckets = 40;
+
+	private:
+		struct alignas(64) slot
+		{
+			std::atomic<std::uint64_t> count[s_buckets + 1]{};
+			std::atomic<std::uint64_t> sum{0};
+		};
+
+		slot m_slots[s_shards];
+
+		// Exported value multiplier (1e-9 for nanoseconds)
+		const double m_scale;
+
+		static std::size_t bucket(std::uint64_t value)
+		{
+			if (!value)
+			{
+				return 0;
+			}
+
+#if defined(__GNUG__)
+			const std::size_t bits = 64 - __builtin_clzll(value);
+#else
+			std::size_t bits = 0;
+
+			while (value >> bits)
+			{
+				bits++;
+			}
+#endif
+			return bits < s_buckets ? bits : s_buckets;
+		}
+
+		friend std::string prometheus();
+
+	public:
+		histogram(const char* name, const char* help, double scale = 1)
+			: metric(name, help, kind::histogram)
+			, m_scale(scale)
+		{
+		}
+
+		void observe(std::uint64_t value)
+		{
+			slot& s = m_slots[shard()];
+			s.count[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+			s.sum.fetch_add(value, std::memory_order_relaxed);
+		}
+
+		// Get total number of values and their sum
+		std::uint64_t count() const;
+		std::uint64_t sum() const;
+	};
+
+	extern std::atomic<trace_sink> g_trace;
+
+	// Measure scope duration in ns, also reported to the trace sink if set
+	class span final
+	{
+		histogram& m_hist;
+
+		const std::uint64_t m_start;
+
+	public:
+		explicit span(histogram& hist)
+			: m_hist(hist)
+			, m_start(now_ns())
+		{
+		}
+
+		span(const span&) = delete;
+
+		~span()
+		{
+			const std::uint64_t duration = now_ns() - m_start;
+			m_hist.observe(duration);
+
+			if (const trace_sink sink = g_trace.load(std::memory_order_relaxed))
+			{
+				sink(m_hist.name(), m_start, duration);
+			}
+		}
+	};
+
+	// Set trace span receiver (nullptr disables tracing)
+	void set_trace(trace_sink sink);
+
+	// Export all metrics in Prometheus text format
+	std::string prometheus();
+#else
+	class counter final
+	{
+	public:
+		constexpr counter(const char*, const char*)
+		{
+		}
+
+		void add(std::uint64_t = 1)
+		{
+		}
+
+		std::uint64_t value() const
+		{
+			return 0;
+		}
+	};
+
+	class gauge final
+	{
+	public:
+		constexpr gauge(const char*, const char*)
+		{
+		}
+
+		void add(std::int64_t)
+		{
+		}
+
+		void set(std::int64_t)
+		{
+		}
+
+		std::int64_t value() const
+		{
+			return 0;
+		}
+	};
+
+	class flags final
+	{
+	public:
+		constexpr flags(const char*, const char*)
+		{
+		}
+
+		void raise(std::uint64_t)
+		{
+		}
+
+		std::uint64_t value() const
+		{
+			return 0;
+		}
+	};
+
+	class histogram final
+	{
+	public:
+		constexpr histogram(const char*, const char*, double = 1)
+		{
+		}
+
+		void observe(std::uint64_t)
+		{
+		}
+
+		std::uint64_t count() const
+		{
+			return 0;
+		}
+
+		std::uint64_t sum() const
+		{
+			return 0;
+		}
+	};
+
+	class span final
+	{
+	public:
+		explicit span(histogram&)
+		{
+		}
+
+		span(const span&) = delete;
+	};
+
+	inline void set_trace(trace_sink)
+	{
+	}
+
+	inline std::string prometheus()
+	{
+		return {};
+	}
+#endif
+}
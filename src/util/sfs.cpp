@@ -1,5 +1,11 @@
 #include "sfs.hpp"
+#include "metrics.hpp"
 #include <algorithm>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
 #include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
@@ -10,6 +16,7 @@
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #endif
@@ -40,7 +47,7 @@ static std::string utf8_path(const wchar_t* wstr)
 }
 #endif
 
-std::unique_ptr<sfs::view> sfs::make_view(const std::string& path, const uchar* aes256_key)
+std::unique_ptr<sfs::view> sfs::make_view(const std::string& path, const uchar* aes256_key, bool mapped)
 {
 #ifdef _WIN32
 	auto handle = CreateFileW(wpath(path).get(), GENERIC_READ | GENERIC_WRITE | DELETE, 0, 0, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
@@ -59,7 +66,7 @@ std::unique_ptr<sfs::view> sfs::make_view(const std::string& path, const uchar*
 
 #endif
 
-	return std::make_unique<sfs::view>(std::move(handle), aes256_key);
+	return std::make_unique<sfs::view>(std::move(handle), aes256_key, mapped);
 }
 
 std::vector<std::string> sfs::find_all(const std::string& path, bool directories)
@@ -130,7 +137,7 @@ std::vector<std::string> sfs::find_all(const std::string& path, bool directories
 #endif
 }
 
-sfs::view::view(handle&& _handle, const uchar* aes256_key)
+sfs::view::view(handle&& _handle, const uchar* aes256_key, bool mapped)
 	: m_handle(_handle)
 {
 	m_enc = EVP_CIPHER_CTX_new();
@@ -160,169 +167,1320 @@ sfs::view::view(handle&& _handle, const uchar* aes256_key)
 	m_count = info.st_size / 4096;
 #endif
 
-	std::memset(m_buf, 0, sizeof(m_buf));
+	if (mapped)
+	{
+		map();
+	}
+
+#ifdef _WIN32
+	_handle = INVALID_HANDLE_VALUE;
+#else
+	_handle = -1;
+#endif
+}
+
+sfs::view::~view()
+{
+	write_back();
+	m_cache.reset();
+	unmap();
+
+	if (m_enc)
+	{
+		EVP_CIPHER_CTX_free(m_enc);
+	}
+
+	if (m_dec)
+	{
+		EVP_CIPHER_CTX_free(m_dec);
+	}
+
+	for (auto ctx : m_encs)
+	{
+		EVP_CIPHER_CTX_free(ctx);
+	}
+
+	for (auto ctx : m_decs)
+	{
+		EVP_CIPHER_CTX_free(ctx);
+	}
+
+	// Automatically delete empty storages
+	if (m_count || !set_delete())
+	{
+#ifdef _WIN32
+		FILE_END_OF_FILE_INFO _eof;
+		_eof.EndOfFile.QuadPart = m_count * 4096;
+		SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &_eof, sizeof(_eof));
+#else
+		::ftruncate(m_handle, m_count * 4096);
+#endif
+
+		// TODO: screw the date/time
+	}
+
+#ifdef _WIN32
+	CloseHandle(m_handle);
+#else
+	::close(m_handle);
+#endif
+}
+
+// Max number of blocks per single I/O syscall
+static constexpr std::size_t s_max_batch = 64;
+
+// Min number of blocks processed by a single thread in a parallel batch
+static constexpr std::size_t s_min_chunk = 16;
+
+static metrics::counter s_blocks_read("sfs_blocks_read_total", "Blocks read through sfs::view");
+static metrics::counter s_blocks_written("sfs_blocks_written_total", "Blocks written through sfs::view");
+static metrics::counter s_decrypt_failures("sfs_decrypt_failures_total", "Blocks failed to authenticate");
+static metrics::histogram s_flush_time("sfs_flush_seconds", "Duration of sfs::view::flush", 1e-9);
+
+namespace
+{
+	// Shared threads for parallel block crypto
+	class crypto_pool final
+	{
+		std::mutex m_mutex;
+
+		std::condition_variable m_cv;
+
+		std::deque<std::function<void()>> m_tasks;
+
+		std::vector<std::thread> m_threads;
+
+		bool m_stop = false;
+
+	public:
+		crypto_pool()
+		{
+			const std::size_t count = std::thread::hardware_concurrency();
+
+			// The caller thread participates as well
+			for (std::size_t i = 1; i < count; i++)
+			{
+				m_threads.emplace_back([this]
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+
+					while (true)
+					{
+						if (m_tasks.empty())
+						{
+							if (m_stop)
+							{
+								break;
+							}
+
+							m_cv.wait(lock);
+							continue;
+						}
+
+						auto task = std::move(m_tasks.front());
+						m_tasks.pop_front();
+						lock.unlock();
+						task();
+						lock.lock();
+					}
+				});
+			}
+		}
+
+		~crypto_pool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+
+			m_cv.notify_all();
+
+			for (auto& t : m_threads)
+			{
+				t.join();
+			}
+		}
+
+		// Get number of threads (excluding the caller)
+		std::size_t size() const
+		{
+			return m_threads.size();
+		}
+
+		// Run func(0) .. func(count - 1) and wait for completion
+		void run(std::size_t count, const std::function<void(std::size_t)>& func)
+		{
+			std::size_t pending = count - 1;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+
+				for (std::size_t i = 1; i < count; i++)
+				{
+					m_tasks.emplace_back([&, i]
+					{
+						func(i);
+
+						std::lock_guard<std::mutex> lock(m_mutex);
+
+						if (--pending == 0)
+						{
+							m_cv.notify_all();
+						}
+					});
+				}
+			}
+
+			m_cv.notify_all();
+
+			func(0);
+
+			// Help with remaining tasks while waiting
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			while (pending)
+			{
+				if (m_tasks.empty())
+				{
+					m_cv.wait(lock);
+					continue;
+				}
+
+				auto task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+				lock.unlock();
+				task();
+				lock.lock();
+			}
+		}
+	};
+
+	crypto_pool& get_crypto_pool()
+	{
+		static crypto_pool s_pool;
+		return s_pool;
+	}
+}
+
+void sfs::run_parallel(std::size_t count, const std::function<void(std::size_t)>& func)
+{
+	if (count)
+	{
+		get_crypto_pool().run(count, func);
+	}
+}
+
+std::size_t sfs::parallelism()
+{
+	return get_crypto_pool().size() + 1;
+}
+
+// Decrypted block cache with CLOCK eviction
+struct sfs::view::cache final
+{
+	struct slot
+	{
+		std::uint64_t ident;
+		std::uint64_t block;
+		bool used;
+		bool ref;
+		bool dirty;
+	};
+
+	struct key_hash
+	{
+		std::size_t operator()(const std::pair<std::uint64_t, std::uint64_t>& key) const
+		{
+			return std::hash<std::uint64_t>()(key.second ^ key.first * 0x9e3779b97f4a7c15);
+		}
+	};
+
+	std::mutex mutex;
+
+	// Number of slots
+	const std::size_t size;
+
+	std::unique_ptr<slot[]> slots;
+
+	// Plaintext for every slot
+	std::unique_ptr<uchar[]> data;
+
+	// (ident, block) -> slot
+	std::unordered_map<std::pair<std::uint64_t, std::uint64_t>, std::size_t, key_hash> map;
+
+	// CLOCK hand
+	std::size_t hand = 0;
+
+	// Number of dirty slots
+	std::size_t dirty = 0;
+
+	// Write generations by block hash: a block read without the lock isn't cached if it was written meanwhile
+	std::uint64_t gens[64]{};
+
+	std::atomic<std::uint64_t> hits{0};
+	std::atomic<std::uint64_t> misses{0};
+
+	explicit cache(std::size_t size)
+		: size(size)
+		, slots(new slot[size]{})
+		, data(new uchar[size * block_size])
+	{
+		map.reserve(size);
+	}
+
+	~cache()
+	{
+		OPENSSL_cleanse(data.get(), size * block_size);
+	}
+
+	uchar* get(std::size_t i)
+	{
+		return data.get() + i * block_size;
+	}
+
+	std::uint64_t& gen(std::uint64_t ident, std::uint64_t block)
+	{
+		return gens[key_hash()({ident, block}) % 64];
+	}
+
+	// Find cached block (returns size if not found)
+	std::size_t find(std::uint64_t ident, std::uint64_t block)
+	{
+		const auto found = map.find({ident, block});
+
+		if (found == map.end())
+		{
+			return size;
+		}
+
+		slots[found->second].ref = true;
+		return found->second;
+	}
+
+	// Remove cached block and wipe its plaintext
+	void drop(std::size_t i)
+	{
+		map.erase({slots[i].ident, slots[i].block});
+		dirty -= slots[i].dirty;
+		OPENSSL_cleanse(get(i), block_size);
+		slots[i] = {};
+	}
+
+	// Get slot for a new block, evicted dirty block is written back (returns size on failure)
+	std::size_t insert(view& v, std::uint64_t ident, std::uint64_t block)
+	{
+		while (true)
+		{
+			const std::size_t i = hand;
+			slot& s = slots[i];
+			hand = (hand + 1) % size;
+
+			if (s.used && s.ref)
+			{
+				// Second chance
+				s.ref = false;
+				continue;
+			}
+
+			if (s.used)
+			{
+				if (s.dirty && !v.store_block(s.block, get(i), s.ident))
+				{
+					return size;
+				}
+
+				drop(i);
+			}
+
+			s.ident = ident;
+			s.block = block;
+			s.used = true;
+			s.ref = true;
+			map.emplace(std::make_pair(ident, block), i);
+			return i;
+		}
+	}
+
+	// Replace cached block with written data (must be called after every successful write)
+	void update(std::uint64_t ident, std::uint64_t block, const uchar* buf)
+	{
+		gen(ident, block)++;
+
+		const auto found = map.find({ident, block});
+
+		if (found != map.end())
+		{
+			slot& s = slots[found->second];
+			std::memcpy(get(found->second), buf, block_size);
+			dirty -= s.dirty;
+			s.dirty = false;
+		}
+	}
+
+	// Replace read data with not yet written cached block
+	void overlay(std::uint64_t ident, std::uint64_t block, uchar* buf)
+	{
+		const auto found = map.find({ident, block});
+
+		if (found != map.end() && slots[found->second].dirty)
+		{
+			std::memcpy(buf, get(found->second), block_size);
+		}
+	}
+};
+
+bool sfs::view::decrypt(EVP_CIPHER_CTX* ctx, std::uint64_t block, const uchar* fblock, uchar* buf, std::uint64_t ident)
+{
+	// Block-specific additional authenticated data
+	block_aad aad;
+	aad.ident = ident;
+	aad.index = block;
+
+	// Decrypt block and verify auth tag
+	int len;
+
+	if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, fblock) != 1 ||
+		EVP_DecryptUpdate(ctx, nullptr, &len, reinterpret_cast<uchar*>(&aad), sizeof(aad)) != 1 ||
+		EVP_DecryptUpdate(ctx, buf, &len, fblock + 16, sfs::block_size) != 1 ||
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, const_cast<uchar*>(fblock) + 4080) != 1 ||
+		EVP_DecryptFinal_ex(ctx, buf + len, &len) <= 0)
+	{
+		s_decrypt_failures.add();
+		return false;
+	}
+
+	return true;
+}
+
+bool sfs::view::encrypt(EVP_CIPHER_CTX* ctx, std::uint64_t block, const uchar* buf, uchar* fblock, std::uint64_t ident)
+{
+	// Block-specific additional authenticated data
+	block_aad aad;
+	aad.ident = ident;
+	aad.index = block;
+
+	// Encrypt block and write auth tag
+	int len;
+
+	if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, fblock) != 1 ||
+		EVP_EncryptUpdate(ctx, nullptr, &len, reinterpret_cast<uchar*>(&aad), sizeof(aad)) != 1 ||
+		EVP_EncryptUpdate(ctx, fblock + 16, &len, buf, sfs::block_size) != 1 ||
+		EVP_EncryptFinal_ex(ctx, fblock + 16 + len, &len) != 1 ||
+		EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, fblock + 4080) != 1)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+EVP_CIPHER_CTX* sfs::view::acquire(bool enc)
+{
+	EVP_CIPHER_CTX* const main = enc ? m_enc : m_dec;
+
+	if (!main)
+	{
+		return nullptr;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_ctx_mutex);
+
+		auto& ctxs = enc ? m_encs : m_decs;
+
+		if (!ctxs.empty())
+		{
+			EVP_CIPHER_CTX* const ctx = ctxs.back();
+			ctxs.pop_back();
+			return ctx;
+		}
+	}
+
+	// Copy initialized context (with the key schedule)
+	EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+
+	if (ctx && EVP_CIPHER_CTX_copy(ctx, main) != 1)
+	{
+		EVP_CIPHER_CTX_free(ctx);
+		ctx = nullptr;
+	}
+
+	return ctx;
+}
+
+void sfs::view::release(bool enc, EVP_CIPHER_CTX* ctx)
+{
+	if (ctx)
+	{
+		std::lock_guard<std::mutex> lock(m_ctx_mutex);
+
+		(enc ? m_encs : m_decs).push_back(ctx);
+	}
+}
+
+void sfs::view::grow(std::uint64_t count)
+{
+	std::uint64_t old = m_count.load();
+
+	while (old < count && !m_count.compare_exchange_weak(old, count))
+	{
+	}
+}
+
+void sfs::view::crypt_batch(bool enc, std::size_t count, bool* results, const std::function<bool(EVP_CIPHER_CTX*, std::size_t)>& func)
+{
+	auto& pool = get_crypto_pool();
+
+	// Get contexts for every thread
+	const std::size_t threads = std::max<std::size_t>(std::min(pool.size() + 1, count / s_min_chunk), 1);
+
+	std::vector<EVP_CIPHER_CTX*> ctxs;
+	ctxs.reserve(threads);
+
+	while (ctxs.size() < threads)
+	{
+		EVP_CIPHER_CTX* const ctx = acquire(enc);
+
+		if (!ctx)
+		{
+			break;
+		}
+
+		ctxs.push_back(ctx);
+	}
+
+	const std::size_t chunks = ctxs.size();
+
+	if (chunks <= 1)
+	{
+		for (std::size_t i = 0; i < count; i++)
+		{
+			results[i] = chunks && func(ctxs[0], i);
+		}
+	}
+	else
+	{
+		// Every thread processes a contiguous range with its own context
+		pool.run(chunks, [&](std::size_t k)
+		{
+			for (std::size_t i = count * k / chunks; i < count * (k + 1) / chunks; i++)
+			{
+				results[i] = func(ctxs[k], i);
+			}
+		});
+	}
+
+	for (auto ctx : ctxs)
+	{
+		release(enc, ctx);
+	}
+}
+
+void sfs::view::map()
+{
+	const std::uint64_t count = m_count;
+
+	if (!count)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	m_map_handle = CreateFileMappingW(m_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!m_map_handle)
+	{
+		return;
+	}
+
+	m_map = static_cast<const uchar*>(MapViewOfFile(m_map_handle, FILE_MAP_READ, 0, 0, 0));
+
+	if (!m_map)
+	{
+		CloseHandle(m_map_handle);
+		m_map_handle = nullptr;
+		return;
+	}
+#else
+	void* const ptr = ::mmap(nullptr, count * 4096, PROT_READ, MAP_SHARED, m_handle, 0);
+
+	if (ptr == MAP_FAILED)
+	{
+		return;
+	}
+
+	m_map = static_cast<const uchar*>(ptr);
+#endif
+
+	m_map_size = count * 4096;
+	m_map_count = count;
+}
+
+void sfs::view::unmap()
+{
+	m_map_count = 0;
+
+	if (!m_map)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_map);
+	CloseHandle(m_map_handle);
+	m_map_handle = nullptr;
+#else
+	::munmap(const_cast<uchar*>(m_map), m_map_size);
+#endif
+
+	m_map = nullptr;
+	m_map_size = 0;
+}
+
+std::shared_lock<std::shared_timed_mutex> sfs::view::lock_map()
+{
+	if (!m_map_count)
+	{
+		// Not mapped (or unmapped), the count must be checked again if locked
+		return {};
+	}
+
+	std::lock_guard<std::mutex> gate(m_map_gate);
+	return std::shared_lock<std::shared_timed_mutex>(m_map_mutex);
+}
+
+const uchar* sfs::view::fetch(std::uint64_t block, std::size_t count, std::size_t& got, std::unique_ptr<uchar[]>& fbuf, std::size_t reserve, std::shared_lock<std::shared_timed_mutex>& map_lock)
+{
+	map_lock = lock_map();
+
+	if (block + count <= m_map_count)
+	{
+		got = count;
+		return m_map + block * 4096;
+	}
+
+	if (map_lock)
+	{
+		map_lock.unlock();
+	}
+
+	if (!fbuf)
+	{
+		fbuf.reset(new uchar[reserve * 4096]);
+	}
+
+	got = read_file(block, fbuf.get(), count);
+	return fbuf.get();
+}
+
+std::size_t sfs::view::read_file(std::uint64_t block, uchar* fblocks, std::size_t count)
+{
+	const std::size_t size = count * 4096;
+
+#ifdef _WIN32
+	// Positional read (doesn't depend on the file pointer)
+	OVERLAPPED ovl{};
+	ovl.Offset     = static_cast<DWORD>(block * 4096);
+	ovl.OffsetHigh = static_cast<DWORD>(block * 4096 >> 32);
+
+	DWORD rlen = 0;
+	if (!ReadFile(m_handle, fblocks, static_cast<DWORD>(size), &rlen, &ovl))
+	{
+		return 0;
+	}
+
+	return rlen / 4096;
+#else
+	std::size_t done = 0;
+
+	while (done < size)
+	{
+		const auto r = ::pread(m_handle, fblocks + done, size - done, block * 4096 + done);
+
+		if (r < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (r <= 0)
+		{
+			break;
+		}
+
+		done += r;
+	}
+
+	return done / 4096;
+#endif
+}
+
+std::size_t sfs::view::write_file(std::uint64_t block, const uchar* fblocks, std::size_t count)
+{
+	const std::size_t size = count * 4096;
+
+#ifdef _WIN32
+	// Positional write (doesn't depend on the file pointer)
+	OVERLAPPED ovl{};
+	ovl.Offset     = static_cast<DWORD>(block * 4096);
+	ovl.OffsetHigh = static_cast<DWORD>(block * 4096 >> 32);
+
+	DWORD wlen = 0;
+	if (!WriteFile(m_handle, fblocks, static_cast<DWORD>(size), &wlen, &ovl))
+	{
+		return 0;
+	}
+
+	return wlen / 4096;
+#else
+	std::size_t done = 0;
+
+	while (done < size)
+	{
+		const auto r = ::pwrite(m_handle, fblocks + done, size - done, block * 4096 + done);
+
+		if (r < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (r <= 0)
+		{
+			break;
+		}
+
+		done += r;
+	}
+
+	return done / 4096;
+#endif
+}
+
+bool sfs::view::load_block(std::uint64_t block, uchar* buf, std::uint64_t ident)
+{
+	// File buffer
+	alignas(16) uchar fblock[4096];
+
+	const uchar* src = fblock;
+
+	const auto map_lock = lock_map();
+
+	if (block < m_map_count)
+	{
+		// Read directly from the mapping
+		src = m_map + block * 4096;
+	}
+	else if (!m_dec || block >= m_count || read_file(block, fblock, 1) != 1)
+	{
+		return false;
+	}
+
+	EVP_CIPHER_CTX* const ctx = m_dec ? acquire(false) : nullptr;
+	const bool result = ctx && decrypt(ctx, block, src, buf, ident);
+	release(false, ctx);
+	return result;
+}
+
+bool sfs::view::store_block(std::uint64_t block, const uchar* buf, std::uint64_t ident)
+{
+	// File buffer
+	alignas(16) uchar fblock[4096];
+
+	// Check state and generate random nonce
+	if (!m_enc || block > m_count || RAND_bytes(fblock, 16) != 1)
+	{
+		return false;
+	}
+
+	EVP_CIPHER_CTX* const ctx = acquire(true);
+	const bool result = ctx && encrypt(ctx, block, buf, fblock, ident);
+	release(true, ctx);
+
+	if (!result || write_file(block, fblock, 1) != 1)
+	{
+		return false;
+	}
+
+	// Update file size if appending
+	grow(block + 1);
+
+	return true;
+}
+
+std::size_t sfs::view::load_blocks(std::uint64_t block, std::size_t count, uchar* buf, std::uint64_t ident)
+{
+	const std::uint64_t fcount = m_count;
+
+	if (!m_dec || block >= fcount)
+	{
+		return 0;
+	}
+
+	count = static_cast<std::size_t>(std::min<std::uint64_t>(count, fcount - block));
+
+	// File buffer (unused if mapped)
+	std::unique_ptr<uchar[]> fbuf;
+
+	std::size_t result = 0;
+
+	while (result < count)
+	{
+		const std::size_t n = std::min(count - result, s_max_batch);
+
+		std::size_t got;
+		std::shared_lock<std::shared_timed_mutex> map_lock;
+		const uchar* const src = fetch(block + result, n, got, fbuf, std::min(count, s_max_batch), map_lock);
+
+		bool ok[s_max_batch];
+
+		crypt_batch(false, got, ok, [&](EVP_CIPHER_CTX* ctx, std::size_t i)
+		{
+			return decrypt(ctx, block + result + i, src + i * 4096, buf + (result + i) * block_size, ident);
+		});
+
+		for (std::size_t i = 0; i < got; i++, result++)
+		{
+			if (!ok[i])
+			{
+				return result;
+			}
+		}
+
+		if (got < n)
+		{
+			break;
+		}
+	}
+
+	return result;
+}
+
+std::size_t sfs::view::store_blocks(std::uint64_t block, std::size_t count, const uchar* buf, std::uint64_t ident)
+{
+	if (!m_enc || block > m_count)
+	{
+		return 0;
+	}
+
+	// File buffer
+	std::unique_ptr<uchar[]> fbuf(new uchar[std::min(count, s_max_batch) * 4096]);
+
+	// Random nonces
+	uchar nonces[s_max_batch * 16];
+
+	std::size_t result = 0;
+
+	while (result < count)
+	{
+		std::size_t n = std::min(count - result, s_max_batch);
+
+		if (RAND_bytes(nonces, static_cast<int>(n * 16)) != 1)
+		{
+			break;
+		}
+
+		bool ok[s_max_batch];
+
+		crypt_batch(true, n, ok, [&](EVP_CIPHER_CTX* ctx, std::size_t i)
+		{
+			std::memcpy(fbuf.get() + i * 4096, nonces + i * 16, 16);
+			return encrypt(ctx, block + result + i, buf + (result + i) * block_size, fbuf.get() + i * 4096, ident);
+		});
+
+		for (std::size_t i = 0; i < n; i++)
+		{
+			if (!ok[i])
+			{
+				// Write only successfully encrypted blocks
+				n = i;
+				count = result + i;
+				break;
+			}
+		}
+
+		const std::size_t put = write_file(block + result, fbuf.get(), n);
+
+		result += put;
+
+		// Update file size if appending
+		grow(block + result);
+
+		if (put < n)
+		{
+			break;
+		}
+	}
+
+	return result;
+}
+
+std::size_t sfs::view::load_blocks(block_req* reqs, std::size_t count, std::uint64_t ident)
+{
+	std::unique_ptr<uchar[]> fbuf;
+
+	std::size_t result = 0;
+
+	for (std::size_t i = 0, n = 1; i < count; i += n, n = 1)
+	{
+		// Find adjacent blocks
+		while (i + n < count && n < s_max_batch && reqs[i + n].block == reqs[i].block + n)
+		{
+			n++;
+		}
+
+		std::size_t got = 0;
+
+		const uchar* src = nullptr;
+
+		std::shared_lock<std::shared_timed_mutex> map_lock;
+
+		const std::uint64_t fcount = m_count;
+
+		if (m_dec && reqs[i].block < fcount)
+		{
+			src = fetch(reqs[i].block, static_cast<std::size_t>(std::min<std::uint64_t>(n, fcount - reqs[i].block)), got, fbuf, std::min(count, s_max_batch), map_lock);
+		}
+
+		bool ok[s_max_batch];
+
+		crypt_batch(false, got, ok, [&](EVP_CIPHER_CTX* ctx, std::size_t j)
+		{
+			return decrypt(ctx, reqs[i + j].block, src + j * 4096, reqs[i + j].data, ident);
+		});
+
+		for (std::size_t j = 0; j < n; j++)
+		{
+			block_req& req = reqs[i + j];
+			req.result = j < got && ok[j];
+			result += req.result;
+		}
+	}
+
+	return result;
+}
+
+std::size_t sfs::view::store_blocks(block_req* reqs, std::size_t count, std::uint64_t ident)
+{
+	std::unique_ptr<uchar[]> fbuf;
+
+	// Random nonces
+	uchar nonces[s_max_batch * 16];
+
+	std::size_t result = 0;
+
+	for (std::size_t i = 0, n = 1; i < count; i += n, n = 1)
+	{
+		// Find adjacent blocks
+		while (i + n < count && n < s_max_batch && reqs[i + n].block == reqs[i].block + n)
+		{
+			n++;
+		}
+
+		std::size_t put = 0;
+
+		if (m_enc && reqs[i].block <= m_count && RAND_bytes(nonces, static_cast<int>(n * 16)) == 1)
+		{
+			if (!fbuf)
+			{
+				fbuf.reset(new uchar[std::min(count, s_max_batch) * 4096]);
+			}
+
+			bool ok[s_max_batch];
+
+			crypt_batch(true, n, ok, [&](EVP_CIPHER_CTX* ctx, std::size_t j)
+			{
+				std::memcpy(fbuf.get() + j * 4096, nonces + j * 16, 16);
+				return encrypt(ctx, reqs[i + j].block, reqs[i + j].data, fbuf.get() + j * 4096, ident);
+			});
+
+			std::size_t ready = 0;
+
+			while (ready < n && ok[ready])
+			{
+				ready++;
+			}
+
+			put = write_file(reqs[i].block, fbuf.get(), ready);
+
+			// Update file size if appending
+			grow(reqs[i].block + put);
+		}
+
+		for (std::size_t j = 0; j < n; j++)
+		{
+			reqs[i + j].result = j < put;
+		}
+
+		result += put;
+	}
+
+	return result;
+}
+
+bool sfs::view::read_block(std::uint64_t block, uchar* buf, std::uint64_t ident)
+{
+	if (m_cache)
+	{
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+		const std::size_t i = m_cache->find(ident, block);
 
-#ifdef _WIN32
-	_handle = INVALID_HANDLE_VALUE;
-#else
-	_handle = -1;
-#endif
+		if (i < m_cache->size)
+		{
+			std::memcpy(buf, m_cache->get(i), block_size);
+			m_cache->hits++;
+			s_blocks_read.add();
+			return true;
+		}
+
+		m_cache->misses++;
+	}
+
+	if (!load_block(block, buf, ident))
+	{
+		return false;
+	}
+
+	s_blocks_read.add();
+	return true;
 }
 
-sfs::view::~view()
+bool sfs::view::write_block(std::uint64_t block, const uchar* buf, std::uint64_t ident)
 {
-	OPENSSL_cleanse(m_buf, sizeof(m_buf));
+	if (!store_block(block, buf, ident))
+	{
+		return false;
+	}
 
-	if (m_enc)
+	s_blocks_written.add();
+
+	if (m_cache)
 	{
-		EVP_CIPHER_CTX_free(m_enc);
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
+		m_cache->update(ident, block, buf);
 	}
 
-	if (m_dec)
+	return true;
+}
+
+std::size_t sfs::view::read_blocks(std::uint64_t block, std::size_t count, uchar* buf, std::uint64_t ident)
+{
+	const std::size_t result = load_blocks(block, count, buf, ident);
+	s_blocks_read.add(result);
+
+	if (m_cache)
 	{
-		EVP_CIPHER_CTX_free(m_dec);
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+		for (std::size_t i = 0; m_cache->dirty && i < result; i++)
+		{
+			m_cache->overlay(ident, block + i, buf + i * block_size);
+		}
 	}
 
-	// Automatically delete empty storages
-	if (m_count || !set_delete())
+	return result;
+}
+
+std::size_t sfs::view::write_blocks(std::uint64_t block, std::size_t count, const uchar* buf, std::uint64_t ident)
+{
+	const std::size_t result = store_blocks(block, count, buf, ident);
+	s_blocks_written.add(result);
+
+	if (m_cache)
 	{
-#ifdef _WIN32
-		FILE_END_OF_FILE_INFO _eof;
-		_eof.EndOfFile.QuadPart = m_count * 4096;
-		SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &_eof, sizeof(_eof));
-#else
-		::ftruncate(m_handle, m_count * 4096);
-#endif
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
 
-		// TODO: screw the date/time
+		for (std::size_t i = 0; i < result; i++)
+		{
+			m_cache->update(ident, block + i, buf + i * block_size);
+		}
 	}
 
-#ifdef _WIN32
-	CloseHandle(m_handle);
-#else
-	::close(m_handle);
-#endif
+	return result;
 }
 
-bool sfs::view::read_block(std::uint64_t block, uchar* buf, std::uint64_t ident)
+std::size_t sfs::view::read_blocks(block_req* reqs, std::size_t count, std::uint64_t ident)
 {
-	// File buffer
-	alignas(16) uchar fblock[4096];
+	const std::size_t result = load_blocks(reqs, count, ident);
+	s_blocks_read.add(result);
 
-	if (!m_dec || block >= m_count)
+	if (m_cache)
 	{
-		return false;
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+		for (std::size_t i = 0; m_cache->dirty && i < count; i++)
+		{
+			if (reqs[i].result)
+			{
+				m_cache->overlay(ident, reqs[i].block, reqs[i].data);
+			}
+		}
 	}
 
-#ifdef _WIN32
-	LARGE_INTEGER fptr;
-	fptr.QuadPart = block * 4096;
-	if (!SetFilePointerEx(m_handle, fptr, nullptr, FILE_BEGIN))
+	return result;
+}
+
+std::size_t sfs::view::write_blocks(block_req* reqs, std::size_t count, std::uint64_t ident)
+{
+	const std::size_t result = store_blocks(reqs, count, ident);
+	s_blocks_written.add(result);
+
+	if (m_cache)
 	{
-		return false;
+		std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+		for (std::size_t i = 0; i < count; i++)
+		{
+			if (reqs[i].result)
+			{
+				m_cache->update(ident, reqs[i].block, reqs[i].data);
+			}
+		}
 	}
 
-	DWORD rlen;
-	if (!ReadFile(m_handle, fblock, sizeof(fblock), &rlen, nullptr) || rlen != sizeof(fblock))
+	return result;
+}
+
+bool sfs::view::write_back()
+{
+	if (!m_cache)
 	{
-		return false;
+		return true;
 	}
-#else
-	if (::lseek(m_handle, block * 4096, SEEK_SET) == -1 || ::read(m_handle, fblock, sizeof(fblock)) == -1)
+
+	std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+	if (!m_cache->dirty)
 	{
-		return false;
+		return true;
 	}
-#endif
 
-	// Block-specific additional authenticated data
-	block_aad aad;
-	aad.ident = ident;
-	aad.index = block;
+	// Collect dirty blocks in file order
+	std::vector<std::size_t> list;
 
-	// Decrypt block and verify auth tag
-	int len;
+	for (std::size_t i = 0; i < m_cache->size; i++)
+	{
+		if (m_cache->slots[i].dirty)
+		{
+			list.push_back(i);
+		}
+	}
 
-	if (EVP_DecryptInit_ex(m_dec, nullptr, nullptr, nullptr, fblock) != 1 ||
-		EVP_DecryptUpdate(m_dec, nullptr, &len, reinterpret_cast<uchar*>(&aad), sizeof(aad)) != 1 ||
-		EVP_DecryptUpdate(m_dec, buf, &len, fblock + 16, sfs::block_size) != 1 ||
-		EVP_CIPHER_CTX_ctrl(m_dec, EVP_CTRL_GCM_SET_TAG, 16, fblock + 4080) != 1 ||
-		EVP_DecryptFinal_ex(m_dec, buf + len, &len) <= 0)
+	std::sort(list.begin(), list.end(), [&](std::size_t a, std::size_t b)
 	{
-		return false;
+		const auto& sa = m_cache->slots[a];
+		const auto& sb = m_cache->slots[b];
+		return sa.ident < sb.ident || (sa.ident == sb.ident && sa.block < sb.block);
+	});
+
+	bool result = true;
+
+	std::vector<block_req> reqs;
+
+	for (std::size_t i = 0, n = 0; i < list.size(); i += n)
+	{
+		// Group by identifier
+		const std::uint64_t ident = m_cache->slots[list[i]].ident;
+
+		reqs.clear();
+
+		for (n = 0; i + n < list.size() && m_cache->slots[list[i + n]].ident == ident; n++)
+		{
+			reqs.push_back({m_cache->slots[list[i + n]].block, m_cache->get(list[i + n]), false});
+		}
+
+		store_blocks(reqs.data(), n, ident);
+
+		for (std::size_t j = 0; j < n; j++)
+		{
+			if (reqs[j].result)
+			{
+				m_cache->slots[list[i + j]].dirty = false;
+				m_cache->dirty--;
+			}
+			else
+			{
+				result = false;
+			}
+		}
 	}
 
-	return true;
+	return result;
 }
 
-bool sfs::view::write_block(std::uint64_t block, const uchar* buf, std::uint64_t ident)
+bool sfs::view::cache_read(std::uint64_t block, std::size_t pos, uchar* dst, std::size_t size)
 {
-	// File buffer
-	alignas(16) uchar fblock[4096];
+	std::unique_lock<std::mutex> lock(m_cache->mutex);
 
-	// Check state and generate random nonce
-	if (!m_enc || block > m_count || RAND_bytes(fblock, 16) != 1)
+	std::size_t i = m_cache->find(0, block);
+
+	if (i < m_cache->size)
 	{
-		return false;
+		std::memcpy(dst, m_cache->get(i) + pos, size);
+		m_cache->hits++;
+		return true;
 	}
 
-	// Block-specific additional authenticated data
-	block_aad aad;
-	aad.ident = ident;
-	aad.index = block;
+	m_cache->misses++;
 
-	// Encrypt block and write auth tag
-	int len;
+	const std::uint64_t gen = m_cache->gen(0, block);
+	lock.unlock();
 
-	if (EVP_EncryptInit_ex(m_enc, nullptr, nullptr, nullptr, fblock) != 1 ||
-		EVP_EncryptUpdate(m_enc, nullptr, &len, reinterpret_cast<uchar*>(&aad), sizeof(aad)) != 1 ||
-		EVP_EncryptUpdate(m_enc, fblock + 16, &len, buf, sfs::block_size) != 1 ||
-		EVP_EncryptFinal_ex(m_enc, fblock + 16 + len, &len) != 1 ||
-		EVP_CIPHER_CTX_ctrl(m_enc, EVP_CTRL_GCM_GET_TAG, 16, fblock + 4080) != 1)
+	// Decrypt without holding the lock
+	alignas(16) uchar sbuf[block_size];
+
+	if (!load_block(block, sbuf, 0))
 	{
+		OPENSSL_cleanse(sbuf, block_size);
 		return false;
 	}
 
-	// Write data
-#ifdef _WIN32
-	LARGE_INTEGER fptr;
-	fptr.QuadPart = block * 4096;
-	if (!SetFilePointerEx(m_handle, fptr, nullptr, FILE_BEGIN))
+	lock.lock();
+
+	i = m_cache->find(0, block);
+
+	// Don't cache the block if it could be overwritten after reading (still valid as the result)
+	if (i == m_cache->size && m_cache->gen(0, block) == gen)
 	{
-		return false;
+		i = m_cache->insert(*this, 0, block);
+
+		if (i < m_cache->size)
+		{
+			std::memcpy(m_cache->get(i), sbuf, block_size);
+		}
 	}
 
-	DWORD wlen;
-	if (!WriteFile(m_handle, fblock, sizeof(fblock), &wlen, nullptr) || wlen != sizeof(fblock))
+	std::memcpy(dst, (i < m_cache->size ? m_cache->get(i) : sbuf) + pos, size);
+	OPENSSL_cleanse(sbuf, block_size);
+	return true;
+}
+
+bool sfs::view::cache_write(std::uint64_t block, std::size_t pos, const uchar* src, std::size_t size)
+{
+	std::unique_lock<std::mutex> lock(m_cache->mutex);
+
+	std::size_t i = m_cache->find(0, block);
+
+	if (i == m_cache->size)
 	{
-		return false;
+		m_cache->misses++;
 	}
-#else
-	if (::lseek(m_handle, block * 4096, SEEK_SET) == -1 || ::write(m_handle, fblock, sizeof(fblock)) == -1)
+	else
+	{
+		m_cache->hits++;
+	}
+
+	while (i == m_cache->size)
+	{
+		const std::uint64_t gen = m_cache->gen(0, block);
+		lock.unlock();
+
+		alignas(16) uchar sbuf[block_size];
+
+		if (!load_block(block, sbuf, 0))
+		{
+			OPENSSL_cleanse(sbuf, block_size);
+			return false;
+		}
+
+		lock.lock();
+
+		i = m_cache->find(0, block);
+
+		if (i == m_cache->size && m_cache->gen(0, block) != gen)
+		{
+			// Written meanwhile, the data read is outdated
+			OPENSSL_cleanse(sbuf, block_size);
+			continue;
+		}
+
+		if (i == m_cache->size)
+		{
+			i = m_cache->insert(*this, 0, block);
+
+			if (i == m_cache->size)
+			{
+				// Write through
+				lock.unlock();
+
+				src ? std::memcpy(sbuf + pos, src, size) : std::memset(sbuf + pos, 0, size);
+
+				const bool result = store_block(block, sbuf, 0);
+				OPENSSL_cleanse(sbuf, block_size);
+
+				if (result)
+				{
+					lock.lock();
+					m_cache->gen(0, block)++;
+				}
+
+				return result;
+			}
+
+			std::memcpy(m_cache->get(i), sbuf, block_size);
+		}
+
+		OPENSSL_cleanse(sbuf, block_size);
+	}
+
+	src ? std::memcpy(m_cache->get(i) + pos, src, size) : std::memset(m_cache->get(i) + pos, 0, size);
+
+	if (!m_cache->slots[i].dirty)
+	{
+		m_cache->slots[i].dirty = true;
+		m_cache->dirty++;
+	}
+
+	return true;
+}
+
+bool sfs::view::set_cache(std::size_t budget)
+{
+	if (!write_back())
 	{
 		return false;
 	}
-#endif
 
-	// Update file size if appending
-	if (block == m_count)
+	m_cache.reset();
+
+	if (const std::size_t size = budget / block_size)
 	{
-		m_count = block + 1;
+		m_cache = std::make_unique<cache>(size);
 	}
 
 	return true;
 }
 
-void sfs::view::flush()
+std::uint64_t sfs::view::cache_hits() const
+{
+	return m_cache ? m_cache->hits.load() : 0;
+}
+
+std::uint64_t sfs::view::cache_misses() const
+{
+	return m_cache ? m_cache->misses.load() : 0;
+}
+
+bool sfs::view::flush()
 {
+	metrics::span span(s_flush_time);
+
+	// Still sync the blocks written successfully
+	const bool written = write_back();
+
 #ifdef _WIN32
-	FlushFileBuffers(m_handle);
+	const bool synced = FlushFileBuffers(m_handle) != 0;
 #else
-	::fsync(m_handle);
+	const bool synced = ::fsync(m_handle) == 0;
 #endif
+
+	return written && synced;
 }
 
 bool sfs::view::alloc(std::uint64_t future_size)
 {
+	std::lock_guard<std::mutex> lock(m_size_mutex);
+
 	// Convert to real filesizes
 	const std::uint64_t old_rs = m_count * 4096;
 	const std::uint64_t new_rs = future_size / block_size * 4096 + (future_size % block_size ? 4096 : 0);
@@ -389,6 +1547,8 @@ bool sfs::view::set_delete()
 
 std::uint64_t sfs::view::trunc(std::uint64_t new_size)
 {
+	std::lock_guard<std::mutex> lock(m_size_mutex);
+
 	// Convert to real filesizes
 	const std::uint64_t old_rs = m_count * 4096;
 	const std::uint64_t new_rs = new_size / block_size * 4096 + (new_size % block_size ? 4096 : 0);
@@ -399,21 +1559,57 @@ std::uint64_t sfs::view::trunc(std::uint64_t new_size)
 		return size();
 	}
 
-	// Only use the syscall for shrinkage
+	// Only use the syscall for shrinkage (hide removed blocks first)
+	if (new_rs < old_rs)
+	{
+		m_count = new_rs / 4096;
+
+		if (m_map_count)
+		{
+			// Wait for readers of the mapping
+			std::unique_lock<std::mutex> gate(m_map_gate);
+			std::lock_guard<std::shared_timed_mutex> map_lock(m_map_mutex);
+			gate.unlock();
+
+#ifdef _WIN32
+			// Mapped file can't be shrunk
+			unmap();
+#else
+			// Keep the mapping, but stop using removed pages
+			if (m_map_count > new_rs / 4096)
+			{
+				m_map_count = new_rs / 4096;
+			}
+#endif
+		}
+
 #ifdef _WIN32
-	FILE_END_OF_FILE_INFO _eof;
-	_eof.EndOfFile.QuadPart = new_rs;
+		FILE_END_OF_FILE_INFO _eof;
+		_eof.EndOfFile.QuadPart = new_rs;
 
-	if (new_rs < old_rs && !SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &_eof, sizeof(_eof)))
-	{
-		return size();
-	}
+		if (!SetFileInformationByHandle(m_handle, FileEndOfFileInfo, &_eof, sizeof(_eof)))
 #else
-	if (new_rs < old_rs && ::ftruncate(m_fd, new_rs) != 0)
-	{
-		return size();
-	}
+		if (::ftruncate(m_handle, new_rs) != 0)
 #endif
+		{
+			m_count = old_rs / 4096;
+			return size();
+		}
+
+		// Drop removed blocks from the cache
+		if (m_cache)
+		{
+			std::lock_guard<std::mutex> lock(m_cache->mutex);
+
+			for (std::size_t i = 0; i < m_cache->size; i++)
+			{
+				if (m_cache->slots[i].used && m_cache->slots[i].block >= new_rs / 4096)
+				{
+					m_cache->drop(i);
+				}
+			}
+		}
+	}
 
 	// Increase file size by writing encrypted zeros
 	if (new_rs > old_rs)
@@ -422,26 +1618,37 @@ std::uint64_t sfs::view::trunc(std::uint64_t new_size)
 		static constexpr uchar s_zeros[block_size]{};
 
 		// Encrypt zero blocks
-		for (std::uint64_t i = old_rs / 4096; i < new_rs / 4096; i++)
+		block_req reqs[s_max_batch];
+
+		for (std::uint64_t i = old_rs / 4096; i < new_rs / 4096;)
 		{
-			if (!write_block(i, s_zeros))
+			const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(new_rs / 4096 - i, s_max_batch));
+
+			for (std::size_t j = 0; j < n; j++)
+			{
+				reqs[j].block = i + j;
+				reqs[j].data  = const_cast<uchar*>(s_zeros);
+			}
+
+			const std::size_t put = write_blocks(reqs, n);
+
+			i += put;
+
+			if (put < n)
 			{
 				return i * block_size;
 			}
 		}
 	}
 
-	// Decrease file size
-	if (new_rs < old_rs)
-	{
-		m_count = new_rs / 4096;
-	}
-
 	return new_rs / 4096 * block_size;
 }
 
 std::size_t sfs::view::read(std::uint64_t _offset, void* buf, std::size_t size)
 {
+	// Buffer for a single plaintext block
+	alignas(16) uchar sbuf[block_size];
+
 	std::size_t result = 0;
 
 	for (std::uint64_t offset = _offset; result < size;)
@@ -449,19 +1656,31 @@ std::size_t sfs::view::read(std::uint64_t _offset, void* buf, std::size_t size)
 		const std::size_t _mod = offset % block_size;
 		const std::size_t _size = std::min(size - result, block_size - _mod);
 
-		if (!read_block(offset / block_size, !buf || _size < block_size ? m_buf : static_cast<uchar*>(buf) + result))
+		if (m_cache && buf && _size < block_size)
+		{
+			if (!cache_read(offset / block_size, _mod, static_cast<uchar*>(buf) + result, _size))
+			{
+				return result;
+			}
+
+			offset += _size;
+			result += _size;
+			continue;
+		}
+
+		if (!read_block(offset / block_size, !buf || _size < block_size ? sbuf : static_cast<uchar*>(buf) + result))
 		{
 			return result;
 		}
 
 		if (buf && _size < block_size)
 		{
-			std::memcpy(static_cast<uchar*>(buf) + result, m_buf + _mod, _size);
+			std::memcpy(static_cast<uchar*>(buf) + result, sbuf + _mod, _size);
 		}
 
 		if (!buf || _size < block_size)
 		{
-			OPENSSL_cleanse(m_buf, block_size);
+			OPENSSL_cleanse(sbuf, block_size);
 		}
 
 		offset += _size;
@@ -493,6 +1712,9 @@ std::size_t sfs::view::write(std::uint64_t _offset, const void* buf, std::size_t
 		fsize = fneed;
 	}
 
+	// Buffer for a single plaintext block
+	alignas(16) uchar sbuf[block_size];
+
 	std::size_t result = 0;
 
 	for (std::uint64_t offset = _offset; result < size;)
@@ -500,12 +1722,25 @@ std::size_t sfs::view::write(std::uint64_t _offset, const void* buf, std::size_t
 		const std::size_t _mod = offset % block_size;
 		const std::size_t _size = std::min(size - result, block_size - _mod);
 
+		if (m_cache && offset < fsize && _size < block_size)
+		{
+			// Partial overwrite of existing block (written back later)
+			if (!cache_write(offset / block_size, _mod, buf ? static_cast<const uchar*>(buf) + result : nullptr, _size))
+			{
+				return result;
+			}
+
+			offset += _size;
+			result += _size;
+			continue;
+		}
+
 		if (offset >= fsize && _size < block_size)
 		{
 			// New block
-			std::memset(m_buf, 0, block_size);
+			std::memset(sbuf, 0, block_size);
 		}
-		else if (_size < block_size && !read_block(offset / block_size, m_buf))
+		else if (_size < block_size && !read_block(offset / block_size, sbuf))
 		{
 			// Partial block overwrite failed
 			return result;
@@ -513,21 +1748,21 @@ std::size_t sfs::view::write(std::uint64_t _offset, const void* buf, std::size_t
 
 		if (buf && _size < block_size)
 		{
-			std::memcpy(m_buf + _mod, static_cast<const uchar*>(buf) + result, _size);
+			std::memcpy(sbuf + _mod, static_cast<const uchar*>(buf) + result, _size);
 		}
 		else if (offset < fsize || _size == block_size)
 		{
-			std::memset(m_buf + _mod, 0, _size);
+			std::memset(sbuf + _mod, 0, _size);
 		}
 
-		if (!write_block(offset / block_size, !buf || _size < block_size ? m_buf : static_cast<const uchar*>(buf) + result))
+		if (!write_block(offset / block_size, !buf || _size < block_size ? sbuf : static_cast<const uchar*>(buf) + result))
 		{
 			return result;
 		}
 
 		if (!buf || _size < block_size)
 		{
-			OPENSSL_cleanse(m_buf, block_size);
+			OPENSSL_cleanse(sbuf, block_size);
 		}
 
 		offset += _size;
@@ -14,6 +14,10 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
 #include "endian.hpp"
 
 extern "C"
@@ -28,7 +32,20 @@ namespace sfs
 	// Encrypted block payload size
 	constexpr std::size_t block_size = 4096 - 32;
 
-	// Encrypted container
+	// Block request for scatter-gather operations
+	struct block_req
+	{
+		// Block index
+		std::uint64_t block;
+
+		// Plaintext buffer (block_size bytes, only read by write operations)
+		uchar* data;
+
+		// Operation result
+		bool result;
+	};
+
+	// Encrypted container (blocks can be accessed concurrently, but the same block must not be written concurrently)
 	class view
 	{
 #ifdef _WIN32
@@ -39,14 +56,48 @@ namespace sfs
 		// Native file handle
 		const handle m_handle;
 
-		// Crypto context (encryption)
+		// Initialized crypto context (encryption), only used as a template
 		EVP_CIPHER_CTX* m_enc;
 
-		// Crypto context (decryption)
+		// Initialized crypto context (decryption), only used as a template
 		EVP_CIPHER_CTX* m_dec;
 
+		// Idle crypto contexts (copies of m_enc and m_dec)
+		std::vector<EVP_CIPHER_CTX*> m_encs;
+		std::vector<EVP_CIPHER_CTX*> m_decs;
+
+		// Protects idle crypto contexts
+		std::mutex m_ctx_mutex;
+
+		// Serializes resizing
+		std::mutex m_size_mutex;
+
 		// Actual file size in blocks
-		std::uint64_t m_count;
+		std::atomic<std::uint64_t> m_count;
+
+		// Decrypted block cache (optional)
+		struct cache;
+		std::unique_ptr<cache> m_cache;
+
+		// Read-only file mapping (optional)
+		const uchar* m_map = nullptr;
+
+		// Number of mapped blocks which can be accessed
+		std::atomic<std::uint64_t> m_map_count{0};
+
+		// Mapping size in bytes
+		std::uint64_t m_map_size = 0;
+
+		// Shared while mapped pages are read, exclusive to shrink or remove the mapping
+		std::shared_timed_mutex m_map_mutex;
+
+		// Taken briefly before m_map_mutex, so trunc() is not starved by new readers
+		std::mutex m_map_gate;
+
+#ifdef _WIN32
+		// File mapping object
+		void* m_map_handle = nullptr;
+#endif
 
 		struct block_aad final
 		{
@@ -54,11 +105,63 @@ namespace sfs
 			std::be_t<std::uint64_t> index; // Current block index
 		};
 
-		// Buffer for a single plaintext block
-		uchar m_buf[block_size];
+		// Decrypt file block and verify auth tag
+		static bool decrypt(EVP_CIPHER_CTX* ctx, std::uint64_t block, const uchar* fblock, uchar* buf, std::uint64_t ident);
+
+		// Encrypt block into file block (nonce must be already set)
+		static bool encrypt(EVP_CIPHER_CTX* ctx, std::uint64_t block, const uchar* buf, uchar* fblock, std::uint64_t ident);
+
+		// Get idle crypto context or make a new one (may return nullptr)
+		EVP_CIPHER_CTX* acquire(bool enc);
+
+		// Return crypto context obtained with acquire()
+		void release(bool enc, EVP_CIPHER_CTX* ctx);
+
+		// Update size after appending blocks
+		void grow(std::uint64_t count);
+
+		// Run crypto for independent blocks, large batches are split between threads
+		void crypt_batch(bool enc, std::size_t count, bool* results, const std::function<bool(EVP_CIPHER_CTX*, std::size_t)>& func);
+
+		// Positional read of file blocks (returns number of complete blocks)
+		std::size_t read_file(std::uint64_t block, uchar* fblocks, std::size_t count);
+
+		// Positional write of file blocks (returns number of complete blocks)
+		std::size_t write_file(std::uint64_t block, const uchar* fblocks, std::size_t count);
+
+		// Map current file contents for reading
+		void map();
+
+		// Remove file mapping
+		void unmap();
+
+		// Lock the mapping for reading if it exists
+		std::shared_lock<std::shared_timed_mutex> lock_map();
+
+		// Get file blocks from the mapping or read them into fbuf (allocated lazily for reserve blocks)
+		// The mapping stays locked by map_lock while the result is used
+		const uchar* fetch(std::uint64_t block, std::size_t count, std::size_t& got, std::unique_ptr<uchar[]>& fbuf, std::size_t reserve, std::shared_lock<std::shared_timed_mutex>& map_lock);
+
+		// Block operations bypassing the cache
+		bool load_block(std::uint64_t block, uchar* buf, std::uint64_t ident);
+		bool store_block(std::uint64_t block, const uchar* buf, std::uint64_t ident);
+		std::size_t load_blocks(std::uint64_t block, std::size_t count, uchar* buf, std::uint64_t ident);
+		std::size_t store_blocks(std::uint64_t block, std::size_t count, const uchar* buf, std::uint64_t ident);
+		std::size_t load_blocks(block_req* reqs, std::size_t count, std::uint64_t ident);
+		std::size_t store_blocks(block_req* reqs, std::size_t count, std::uint64_t ident);
+
+		// Write back dirty cached blocks
+		bool write_back();
+
+		// Partial block read through the cache
+		bool cache_read(std::uint64_t block, std::size_t pos, uchar* dst, std::size_t size);
+
+		// Partial block write into the cache (src may be nullptr to write zeros)
+		bool cache_write(std::uint64_t block, std::size_t pos, const uchar* src, std::size_t size);
 
 	public:
-		view(handle&& _handle, const uchar* aes256_key);
+		// Optionally map the file (ciphertext is read directly from the mapping, appended blocks use normal reads)
+		view(handle&& _handle, const uchar* aes256_key, bool mapped = false);
 
 		view(const view&) = delete;
 
@@ -76,8 +179,17 @@ namespace sfs
 			return m_count;
 		}
 
-		// Ensure disc writes
-		void flush();
+		// Write back cached blocks and ensure disc writes (false if any block or the sync failed)
+		bool flush();
+
+		// Set memory budget in bytes for decrypted block cache (0 disables, not thread-safe)
+		bool set_cache(std::size_t budget);
+
+		// Get number of block reads served from the cache
+		std::uint64_t cache_hits() const;
+
+		// Get number of block reads which missed the cache
+		std::uint64_t cache_misses() const;
 
 		// Allocate storage without changing the size (may do nothing)
 		bool alloc(std::uint64_t future_size);
@@ -88,6 +200,18 @@ namespace sfs
 		bool read_block(std::uint64_t block, uchar* buf, std::uint64_t ident = 0);
 		bool write_block(std::uint64_t block, const uchar* buf, std::uint64_t ident = 0);
 
+		// Read consecutive blocks (returns number of blocks read before the first failure)
+		std::size_t read_blocks(std::uint64_t block, std::size_t count, uchar* buf, std::uint64_t ident = 0);
+
+		// Write consecutive blocks (returns number of blocks written before the first failure)
+		std::size_t write_blocks(std::uint64_t block, std::size_t count, const uchar* buf, std::uint64_t ident = 0);
+
+		// Read arbitrary blocks, adjacent requests are coalesced (returns number of successful requests)
+		std::size_t read_blocks(block_req* reqs, std::size_t count, std::uint64_t ident = 0);
+
+		// Write arbitrary blocks in order, adjacent requests are coalesced (returns number of successful requests)
+		std::size_t write_blocks(block_req* reqs, std::size_t count, std::uint64_t ident = 0);
+
 		// Resize storage (returns new size, multiple of block_size)
 		std::uint64_t trunc(std::uint64_t new_size);
 
@@ -100,8 +224,14 @@ namespace sfs
 	std::unique_ptr<wchar_t[]> wpath(const std::string& utf8_path);
 #endif
 
-	// Try to open an archive file (UTF-8 path)
-	std::unique_ptr<view> make_view(const std::string& path, const uchar* aes256_key);
+	// Run func(0) .. func(count - 1) on the shared crypto threads and wait for completion
+	void run_parallel(std::size_t count, const std::function<void(std::size_t)>& func);
+
+	// Get number of shared crypto threads (including the caller)
+	std::size_t parallelism();
+
+	// Try to open an archive file (UTF-8 path), mapped for reading if requested
+	std::unique_ptr<view> make_view(const std::string& path, const uchar* aes256_key, bool mapped = false);
 
 	// Get list of files or directories in the directory (UTF-8 path)
 	std::vector<std::string> find_all(const std::string& path, bool directories = false);
@@ -1,6 +1,11 @@
 #include "ssdb.hpp"
 #include <openssl/hmac.h>
 
+metrics::histogram ssdb::stats::commit_time("ssdb_commit_seconds", "Duration of umap commits", 1e-9);
+metrics::histogram ssdb::stats::commit_blocks("ssdb_commit_blocks", "Blocks written per umap commit (including terminator)");
+metrics::flags ssdb::stats::errors("ssdb_error_bits", "Error bits raised by any umap");
+metrics::gauge ssdb::stats::free_extents("ssdb_free_extents", "Free space extents of all open umaps");
+
 ssdb::combined_hash::combined_hash(const void* salt, int len)
 	: m_hmac(HMAC_CTX_new())
 {
@@ -47,7 +52,13 @@ void ssdb::free_space::add_free(std::uint32_t block, std::uint32_t count)
 		return;
 	}
 
-	auto it = m_free.emplace(block, count).first;
+	const auto res = m_free.emplace(block, count);
+	auto it = res.first;
+
+	if (!res.second)
+	{
+		m_sizes.erase({it->second, it->first});
+	}
 
 	// Extend if necessary
 	if (it->second < count)
@@ -69,6 +80,7 @@ void ssdb::free_space::add_free(std::uint32_t block, std::uint32_t count)
 		if (it2->first + it2->second >= it->first)
 		{
 			// Merge with the previous entry
+			m_sizes.erase({it2->second, it2->first});
 			it2->second += it->second - (it2->first + it2->second - it->first);
 			m_free.erase(it);
 			it = it2;
@@ -81,33 +93,21 @@ void ssdb::free_space::add_free(std::uint32_t block, std::uint32_t count)
 	if (it3 != m_free.end() && it->first + it->second >= it3->first)
 	{
 		// Merge with the next entry
+		m_sizes.erase({it3->second, it3->first});
 		it->second += it3->second - (it->first + it->second - it3->first);
 		m_free.erase(it3);
 	}
+
+	m_sizes.emplace(it->second, it->first);
+	report();
 }
 
 std::uint32_t ssdb::free_space::get_free(std::uint32_t count)
 {
-	auto res = m_free.cend();
+	// Find the smallest fitting free space (the first one if equal)
+	const auto res = m_sizes.lower_bound({count, 0});
 
-	// Find the smallest fitting free space
-	for (auto it = m_free.cbegin(), end = res; it != end; it++)
-	{
-		if (it->second >= count)
-		{
-			if (res == end || res->second > it->second)
-			{
-				res = it;
-
-				if (res->second == count)
-				{
-					break;
-				}
-			}
-		}
-	}
-
-	if (res == m_free.cend())
+	if (res == m_sizes.cend())
 	{
 		if (m_free.empty())
 		{
@@ -115,6 +115,8 @@ std::uint32_t ssdb::free_space::get_free(std::uint32_t count)
 			if (count)
 			{
 				m_free.emplace(count, 0 - count);
+				m_sizes.emplace(0 - count, count);
+				report();
 			}
 
 			return 0;
@@ -123,25 +125,112 @@ std::uint32_t ssdb::free_space::get_free(std::uint32_t count)
 		throw std::bad_alloc();
 	}
 
-	const std::uint32_t pos = res->first;
+	return take_free(m_free.find(res->second), count);
+}
 
-	if (const std::uint32_t diff = res->second - count)
-	{
-		m_free.erase(res);
+std::uint32_t ssdb::free_space::take_free(std::map<std::uint32_t, std::uint32_t>::iterator it, std::uint32_t count)
+{
+	const std::uint32_t pos = it->first;
+	const std::uint32_t diff = it->second - count;
+
+	m_sizes.erase({it->second, it->first});
+	m_free.erase(it);
 
+	if (diff)
+	{
 		// Restore the fragment
 		m_free.emplace(pos + count, diff);
+		m_sizes.emplace(diff, pos + count);
 	}
-	else
+	else if (m_free.empty())
 	{
-		m_free.erase(res);
-
 		// Prevent from restoring the default state
-		if (m_free.empty())
+		m_free.emplace(0, 0);
+		m_sizes.emplace(0, 0);
+	}
+
+	report();
+	return pos;
+}
+
+std::set<std::pair<std::uint32_t, std::uint32_t>>::const_iterator ssdb::free_space::find_free_below(std::uint32_t count, std::uint32_t limit) const
+{
+	// Check the lowest extent of each fitting size, skip the rest of the size if it doesn't end before the limit
+	for (auto it = m_sizes.lower_bound({count, 0}); it != m_sizes.cend();)
+	{
+		if (it->second < limit && limit - it->second >= count)
+		{
+			return it;
+		}
+
+		if (it->first == UINT32_MAX)
 		{
-			m_free.emplace(0, 0);
+			break;
 		}
+
+		it = m_sizes.lower_bound({it->first + 1, 0});
 	}
 
-	return pos;
+	return m_sizes.cend();
+}
+
+std::uint32_t ssdb::free_space::get_free_below(std::uint32_t count, std::uint32_t limit)
+{
+	const auto res = find_free_below(count, limit);
+
+	if (res != m_sizes.cend())
+	{
+		return take_free(m_free.find(res->second), count);
+	}
+
+	return get_free(count);
+}
+
+bool ssdb::free_space::has_free_below(std::uint32_t count, std::uint32_t limit) const
+{
+	return find_free_below(count, limit) != m_sizes.cend();
+}
+
+std::uint32_t ssdb::free_space::used_below(std::uint32_t block) const
+{
+	if (m_free.empty())
+	{
+		return 0;
+	}
+
+	// Find free extent containing block - 1 (skip empty entries)
+	for (auto it = m_free.upper_bound(block - 1); block && it != m_free.begin();)
+	{
+		if ((--it)->second == 0)
+		{
+			continue;
+		}
+
+		if (std::uint64_t{it->first} + it->second >= block)
+		{
+			return it->first;
+		}
+
+		break;
+	}
+
+	return block;
+}
+
+void ssdb::free_space::clear_free()
+{
+	m_free.clear();
+	m_sizes.clear();
+	report();
+}
+
+ssdb::free_space::~free_space()
+{
+	clear_free();
+}
+
+void ssdb::free_space::report()
+{
+	stats::free_extents.add(static_cast<std::int64_t>(m_free.size()) - static_cast<std::int64_t>(m_reported));
+	m_reported = m_free.size();
 }
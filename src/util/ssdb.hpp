@@ -1,12 +1,20 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <algorithm>
 #include "sfs.hpp"
 #include "sstl.hpp"
 #include "endian.hpp"
+#include "flat_map.hpp"
+#include "metrics.hpp"
 
 extern "C"
 {
@@ -34,6 +42,17 @@ namespace ssdb
 		uchar data[sfs::block_size - 4 * sizeof(std::uint64_t)];
 	};
 
+	static_assert(sizeof(block_layout) == sfs::block_size, "Invalid block_layout size");
+
+	// Aggregated over all maps
+	namespace stats
+	{
+		extern metrics::histogram commit_time;
+		extern metrics::histogram commit_blocks;
+		extern metrics::flags errors;
+		extern metrics::gauge free_extents;
+	}
+
 	struct control
 	{
 		// Current block order (0 - should be assigned and written)
@@ -44,6 +63,9 @@ namespace ssdb
 
 		// Written block, moved to loaded block after successful flush
 		std::uint32_t new_block, new_count;
+
+		// Value is loaded in memory (only used in index-only mode)
+		bool resident;
 	};
 
 	constexpr control null_control{};
@@ -87,21 +109,79 @@ namespace ssdb
 		// Default state (empty) means 2^32 free blocks
 		std::map<std::uint32_t, std::uint32_t> m_free;
 
+		// Same extents ordered by (size, block) for best-fit search
+		std::set<std::pair<std::uint32_t, std::uint32_t>> m_sizes;
+
 		void add_free(std::uint32_t block, std::uint32_t count);
 
 		std::uint32_t get_free(std::uint32_t count);
+
+		// Get the smallest free space ending before the limit, fall back to get_free() if not found
+		std::uint32_t get_free_below(std::uint32_t count, std::uint32_t limit);
+
+		// Check if get_free_below() can succeed without the fallback
+		bool has_free_below(std::uint32_t count, std::uint32_t limit) const;
+
+		// Get the end of used space at or below the block (start of the free extent containing block - 1)
+		std::uint32_t used_below(std::uint32_t block) const;
+
+		void clear_free();
+
+		~free_space();
+
+	private:
+		// Number of extents reported to stats::free_extents
+		std::size_t m_reported = 0;
+
+		std::uint32_t take_free(std::map<std::uint32_t, std::uint32_t>::iterator it, std::uint32_t count);
+
+		// Find the (size, block) entry for get_free_below(), one lookup per distinct size
+		std::set<std::pair<std::uint32_t, std::uint32_t>>::const_iterator find_free_below(std::uint32_t count, std::uint32_t limit) const;
+
+		void report();
+
+	public:
+		// Get number of free extents
+		std::size_t fragments() const
+		{
+			return m_free.size();
+		}
 	};
 
-	template <typename K, typename T, typename H = std::hash<K>>
+	// Map container can be replaced (must keep item addresses stable), for example with ssdb::flat_map
+	template <typename K, typename T, typename H = std::hash<K>, template <typename...> class M = std::unordered_map>
 	class umap final : free_space
 	{
-		std::unordered_map<K, std::pair<control, T>, H> m_map;
+	public:
+		using free_space::fragments;
+
+	private:
+		using item_type = std::pair<const K, std::pair<control, T>>;
+
+		using map_type = M<K, std::pair<control, T>, H>;
+
+		map_type m_map;
+
+		// Records which should be written (order == 0), map items are stable
+		std::vector<item_type*> m_dirty;
+
+		// Written records (new_count != 0) which may be moved to loaded blocks after flush
+		std::vector<item_type*> m_written;
+
+		// Records with values loaded in memory (index-only mode)
+		std::vector<item_type*> m_resident;
+
+		// Keep only keys in memory, values are read from the storage on demand
+		bool m_index = false;
 
 		std::unique_ptr<sfs::view> m_data;
 
 		// Error bits
 		std::uint32_t m_error{0};
 
+		// Number of blocks written since the last terminator
+		std::uint64_t m_commit_blocks = 0;
+
 		// Block index of the previous terminator
 		std::uint32_t m_lastf;
 
@@ -114,9 +194,58 @@ namespace ssdb
 		// Combined SHA-512 hash of the all order indices in use (HMAC(key, 33) ^ HMAC(key, 444) ^ ...)
 		combined_hash m_hash;
 
-		// Note: should not use shared mutex
+		// Serializes writers (held during commit)
 		std::mutex m_mutex;
 
+		// Map access: shared by readers, exclusive only while a writer modifies the map (not during commit)
+		std::shared_timed_mutex m_access;
+
+		// Taken briefly before m_access, so a waiting writer is not starved by new readers
+		std::mutex m_gate;
+
+		// Protects record locations of non-resident values which can be changed during commit (index-only mode)
+		std::mutex m_ctrl_mutex;
+
+		// Acquire shared or exclusive map access
+		std::shared_lock<std::shared_timed_mutex> lock_shared()
+		{
+			std::lock_guard<std::mutex> gate(m_gate);
+			return std::shared_lock<std::shared_timed_mutex>(m_access);
+		}
+
+		std::unique_lock<std::shared_timed_mutex> lock_unique()
+		{
+			std::lock_guard<std::mutex> gate(m_gate);
+			return std::unique_lock<std::shared_timed_mutex>(m_access);
+		}
+
+		// Block ranges referenced by the last durable terminator, freed after the next sync
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> m_pending;
+
+		// Last terminator is written but not synced
+		bool m_unsynced = false;
+
+		// Don't sync the terminator, the next commit (or sync) makes it durable
+		bool m_lazy = false;
+
+		// Group commit: time to wait for other flush callers
+		std::chrono::microseconds m_window{0};
+
+		// Group commit is in progress
+		bool m_committing = false;
+
+		// Compaction: allocate blocks below this limit if possible (0 = normal allocation)
+		std::uint32_t m_limit = 0;
+
+		// Signaled on group commit completion
+		std::condition_variable m_cv;
+
+		void error(std::uint32_t bits)
+		{
+			m_error |= bits;
+			stats::errors.raise(bits);
+		}
+
 		// Add/remove order hash
 		void xor_order(std::uint64_t order, std::uint64_t pos)
 		{
@@ -124,39 +253,94 @@ namespace ssdb
 			m_hash.combine(+data, sizeof(data));
 		}
 
-		void reload()
+		// Record version found on reload
+		struct version
 		{
-			const std::uint32_t count = static_cast<std::uint32_t>(m_data->size() / sfs::block_size);
+			std::uint64_t order;
+			std::uint32_t block;
+			std::uint32_t count;
+			item_type* item;
+		};
 
-			uchar last_hash[combined_hash::size()]{};
+		// Load the map in a single pass, recovery uses collected metadata of all record versions
+		void reload(const std::function<void(std::uint64_t, std::uint64_t)>& progress)
+		{
+			const std::uint32_t count = static_cast<std::uint32_t>(m_data->size() / sfs::block_size);
 
 			std::vector<uchar> buf;
 
 			m_map.clear();
-			m_free.clear();
+			m_dirty.clear();
+			m_written.clear();
+			m_resident.clear();
+			m_pending.clear();
+			m_unsynced = false;
+			clear_free();
 			m_hash.clear();
 			m_order = 0;
 			m_lastf = -1;
-			add_free(count, 0 - count);
 
-			block_layout sbuf;
+			// Metadata of every valid record
+			std::vector<version> versions;
+
+			// Last terminator
+			std::uint64_t last_order = 0;
+			uchar last_hash[combined_hash::size()]{};
+
+			// Max order of all blocks
+			std::uint64_t max_order = 0;
+
+			// Read-ahead buffer for batched block reads (decrypted in parallel)
+			const std::uint32_t ahead = std::min<std::uint32_t>(count, 1024);
+			std::vector<block_layout> rbuf(ahead);
+			std::vector<sfs::block_req> reqs(ahead);
+			std::uint32_t rpos = 0;
+			std::uint32_t rend = 0;
+
+			// Get decrypted block (null on failure), blocks are requested in increasing order
+			const auto get_block = [&](std::uint32_t block) -> const block_layout*
+			{
+				if (block < rpos || block >= rend)
+				{
+					rpos = block;
+					rend = block + std::min(ahead, count - block);
+
+					for (std::uint32_t j = rpos; j < rend; j++)
+					{
+						reqs[j - rpos].block = j;
+						reqs[j - rpos].data  = reinterpret_cast<uchar*>(&rbuf[j - rpos]);
+					}
+
+					m_data->read_blocks(reqs.data(), rend - rpos);
+
+					if (progress)
+					{
+						progress(rend, count);
+					}
+				}
 
+				return reqs[block - rpos].result ? &rbuf[block - rpos] : nullptr;
+			};
+
+			// Single pass: collect metadata, build the map from the newest versions
 			for (std::uint32_t i = 0; i < count; i++)
 			{
-				if (!m_data->read_block(i, reinterpret_cast<uchar*>(&sbuf)))
+				const block_layout* const pbuf = get_block(i);
+
+				if (!pbuf)
 				{
-					m_error |= 1;
-					add_free(i, 1);
+					error(1);
 					continue;
 				}
 
+				const block_layout& sbuf = *pbuf;
+
 				const std::uint64_t _order = sbuf.order;
 				const std::uint32_t _block = i;
 
 				if (_order - 1 >= INT64_MAX)
 				{
-					m_error |= 2;
-					add_free(i, 1);
+					error(2);
 					continue;
 				}
 
@@ -164,24 +348,15 @@ namespace ssdb
 				{
 					if (sbuf.size != -1)
 					{
-						m_error |= 2;
+						error(2);
 					}
 
-					add_free(i, 1);
 					continue;
 				}
 
-				if (m_flush != -1 && _order > m_order)
-				{
-					// Remember max order
-					m_order = _order;
-				}
-
-				if (_order > m_flush)
+				if (_order > max_order)
 				{
-					m_error |= 4;
-					add_free(i, 1);
-					continue;
+					max_order = _order;
 				}
 
 				// Get record size
@@ -190,110 +365,361 @@ namespace ssdb
 				if (size == 0)
 				{
 					// Terminator
-					if (m_flush == -1 && _order > m_order)
-					{
-						add_free(m_lastf, 1);
-						std::memcpy(last_hash, sbuf.data, sizeof(last_hash));
-						m_order = _order;
-						m_lastf = _block;
-					}
-					else if (m_flush == _order)
+					if (_order > last_order)
 					{
 						std::memcpy(last_hash, sbuf.data, sizeof(last_hash));
+						last_order = _order;
 						m_lastf = _block;
 					}
-					else
-					{
-						add_free(i, 1);
-					}
 
 					continue;
 				}
 
-				buf.clear();
-				buf.reserve(size);
-				buf.insert(buf.end(), sbuf.data, sbuf.data + std::min(size, sizeof(sbuf.data)));
-				size -= std::min(size, sizeof(sbuf.data));
+				const std::size_t total = size;
+
+				// Parse in place if the record fits in one block (the block is valid until the next get_block() call)
+				const uchar* data = sbuf.data;
 
-				for (std::uint32_t j = i + 1; size > sizeof(sbuf.data) && j < count; j++, i++)
+				if (size > sizeof(sbuf.data))
 				{
-					if (!m_data->read_block(i, reinterpret_cast<uchar*>(&sbuf)) || sbuf.order != _order || sbuf.size != -1)
+					buf.clear();
+					buf.reserve(size);
+					buf.insert(buf.end(), sbuf.data, sbuf.data + sizeof(sbuf.data));
+					size -= sizeof(sbuf.data);
+
+					for (std::uint32_t j = i + 1; size && j < count; j++, i++)
 					{
-						m_error |= 8;
-						add_free(_block, (i + 1) - _block);
-						break;
+						const block_layout* const cbuf = get_block(j);
+
+						if (!cbuf || cbuf->order != _order || cbuf->size != -1)
+						{
+							error(8);
+							break;
+						}
+
+						buf.insert(buf.end(), cbuf->data, cbuf->data + std::min(size, sizeof(cbuf->data)));
+						size -= std::min(size, sizeof(cbuf->data));
 					}
 
-					buf.insert(buf.end(), sbuf.data, sbuf.data + std::min(size, sizeof(sbuf.data)));
-					size -= std::min(size, sizeof(sbuf.data));
-				}
+					if (size)
+					{
+						error(16);
+						continue;
+					}
 
-				if (size)
-				{
-					m_error |= 16;
-					continue;
+					data = buf.data();
 				}
 
-				sstl::context_data ctx(sstl::context_type::reading, reinterpret_cast<sstl::byte*>(buf.data()), buf.size());
+				sstl::context_data ctx(sstl::context_type::reading, reinterpret_cast<sstl::byte*>(const_cast<uchar*>(data)), total);
 
 				K key{};
 				ctx.traverse<sstl::context_type::reading>(key);
 
-				auto& pair = m_map.emplace(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first->second;
+				auto& item = *m_map.emplace(std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first;
+				auto& pair = item.second;
 				auto& ctrl = pair.first;
 
+				versions.push_back({_order, _block, (i + 1) - _block, &item});
+
 				if (ctrl.order < _order)
 				{
-					if (ctrl.order)
-					{
-						// Overwrite the block
-						xor_order(ctrl.order, ctrl.load_block);
-						add_free(ctrl.load_block, ctrl.load_count);
-					}
-
 					ctrl.order      = _order;
 					ctrl.load_block = _block;
 					ctrl.load_count = (i + 1) - _block;
-					pair.second     = {};
-					ctx.traverse<sstl::context_type::reading>(pair.second);
-					xor_order(sbuf.order, _block);
+
+					if (!m_index)
+					{
+						pair.second = {};
+						ctx.traverse<sstl::context_type::reading>(pair.second);
+					}
+				}
+			}
+
+			for (auto& item : m_map)
+			{
+				xor_order(item.second.first.order, item.second.first.load_block);
+			}
+
+			if (m_hash.check(last_hash))
+			{
+				// Normal state
+				m_order = last_order;
+				m_flush = last_order;
+			}
+			else
+			{
+				// Try to rollback unfinished modifications: select newest versions not newer than the terminator
+				// Group by item (std::less gives a total order of unrelated pointers), orders are unique per item
+				std::sort(versions.begin(), versions.end(), [](const version& a, const version& b)
+				{
+					return std::less<const item_type*>{}(a.item, b.item) || (a.item == b.item && a.order > b.order);
+				});
+
+				m_hash.clear();
+
+				for (std::size_t i = 0; i < versions.size();)
+				{
+					item_type* const item = versions[i].item;
+
+					bool found = false;
+
+					for (; i < versions.size() && versions[i].item == item; i++)
+					{
+						if (!found && versions[i].order <= last_order)
+						{
+							xor_order(versions[i].order, versions[i].block);
+							found = true;
+						}
+					}
+				}
+
+				if (m_hash.check(last_hash))
+				{
+					// Reload rolled back records (Last order is lie)
+					if (max_order > last_order)
+					{
+						error(4);
+					}
+
+					m_order = max_order;
+					m_flush = max_order;
+
+					for (std::size_t i = 0; i < versions.size();)
+					{
+						item_type* const item = versions[i].item;
+
+						const version* found = nullptr;
+
+						for (; i < versions.size() && versions[i].item == item; i++)
+						{
+							if (!found && versions[i].order <= last_order)
+							{
+								found = &versions[i];
+							}
+						}
+
+						control& ctrl = item->second.first;
+
+						if (found && found->order == ctrl.order)
+						{
+							continue;
+						}
+
+						// Only check readability in index-only mode
+						T value{};
+
+						if (found && load(*found, m_index ? value : item->second.second))
+						{
+							ctrl.order      = found->order;
+							ctrl.load_block = found->block;
+							ctrl.load_count = found->count;
+						}
+						else
+						{
+							// Record didn't exist (or became unreadable)
+							if (found)
+							{
+								xor_order(found->order, found->block);
+								error(1);
+							}
+
+							m_map.erase(m_map.find(item->first));
+						}
+					}
 				}
 				else
 				{
-					add_free(_block, (i + 1) - _block);
+					// Heavy damage: keep the newest versions without terminator
+					error(32);
+					m_hash.clear();
+
+					for (auto& item : m_map)
+					{
+						xor_order(item.second.first.order, item.second.first.load_block);
+					}
+
+					m_order = max_order;
+					m_flush = 0;
+					m_lastf = -1;
 				}
 			}
 
-			if (m_flush == -1)
+			// Free space is everything not used by the selected records and the terminator
+			std::vector<std::pair<std::uint32_t, std::uint32_t>> used;
+			used.reserve(m_map.size() + 1);
+
+			for (auto& item : m_map)
+			{
+				used.emplace_back(item.second.first.load_block, item.second.first.load_count);
+			}
+
+			if (m_lastf != -1)
 			{
-				// Complete first (optimistic) attempt
-				m_flush = m_order;
+				used.emplace_back(m_lastf, 1);
+			}
+
+			std::sort(used.begin(), used.end());
+
+			std::uint32_t pos = 0;
 
-				if (!m_hash.check(last_hash))
+			for (const auto& range : used)
+			{
+				add_free(pos, range.first - pos);
+				pos = range.first + range.second;
+			}
+
+			add_free(pos, count - pos);
+			add_free(count, 0 - count);
+		}
+
+		// Get record data from its blocks, concatenated into buf only if it doesn't fit in one block (nullptr if incomplete)
+		static const uchar* assemble(const std::vector<block_layout>& sbuf, std::vector<uchar>& buf)
+		{
+			std::size_t size = static_cast<std::size_t>(sbuf[0].size);
+
+			if (size <= sizeof(sbuf[0].data))
+			{
+				return sbuf[0].data;
+			}
+
+			buf.clear();
+			buf.reserve(size);
+
+			for (auto& block : sbuf)
+			{
+				buf.insert(buf.end(), block.data, block.data + std::min(size, sizeof(block.data)));
+				size -= std::min(size, sizeof(block.data));
+			}
+
+			return size ? nullptr : buf.data();
+		}
+
+		// Read record version again
+		bool load(const version& ver, T& value)
+		{
+			std::vector<block_layout> sbuf(ver.count);
+
+			if (!ver.count || m_data->read_blocks(ver.block, ver.count, reinterpret_cast<uchar*>(sbuf.data())) != ver.count || sbuf[0].order != ver.order || sbuf[0].size >= (1u << 31))
+			{
+				return false;
+			}
+
+			// Blocks may be reused if the location is outdated
+			for (std::uint32_t i = 1; i < ver.count; i++)
+			{
+				if (sbuf[i].order != ver.order || sbuf[i].size != -1)
 				{
-					return reload();
+					return false;
 				}
 			}
-			else if (m_flush == -2)
+
+			std::vector<uchar> buf;
+
+			const uchar* data = assemble(sbuf, buf);
+
+			if (!data)
 			{
-				// Complete third attempt (heavy damage)
-				m_flush = 0;
-				m_error |= 32;
+				return false;
 			}
-			else if (!m_hash.check(last_hash))
+
+			sstl::context_data ctx(sstl::context_type::reading, reinterpret_cast<sstl::byte*>(const_cast<uchar*>(data)), static_cast<std::size_t>(sbuf[0].size));
+
+			K key{};
+			ctx.traverse<sstl::context_type::reading>(key);
+			value = {};
+			ctx.traverse<sstl::context_type::reading>(value);
+			return true;
+		}
+
+		// Get current location of the record
+		static version locate(const control& ctrl)
+		{
+			if (ctrl.new_count)
 			{
-				m_flush = -2;
-				return reload();
+				return {ctrl.order, ctrl.new_block, ctrl.new_count, nullptr};
 			}
-			else
+
+			return {ctrl.order, ctrl.load_block, ctrl.load_count, nullptr};
+		}
+
+		// Load the value into memory if necessary (exclusive access, returns nullptr on failure)
+		T* fetch(item_type& item)
+		{
+			control& ctrl = item.second.first;
+
+			if (m_index && !ctrl.resident)
+			{
+				if (!load(locate(ctrl), item.second.second))
+				{
+					error(1);
+					return nullptr;
+				}
+
+				ctrl.resident = true;
+				m_resident.push_back(&item);
+			}
+
+			return &item.second.second;
+		}
+
+		// Copy the value, it's read from the storage if not resident (shared access)
+		bool copy(const item_type& item, T& value)
+		{
+			const control& ctrl = item.second.first;
+
+			if (!m_index || ctrl.resident)
+			{
+				value = item.second.second;
+				return true;
+			}
+
+			version last{};
+
+			while (true)
 			{
-				// Complete second attempt (rollback unfinished modifications)
-				// Last order is lie
-				m_flush = m_order;
+				version ver;
+				{
+					std::lock_guard<std::mutex> lock(m_ctrl_mutex);
+					ver = locate(ctrl);
+				}
+
+				if (load(ver, value))
+				{
+					return true;
+				}
+
+				// Retry if the record was moved meanwhile
+				if (ver.order == last.order && ver.block == last.block)
+				{
+					return false;
+				}
+
+				last = ver;
 			}
 		}
 
-		void dirty(std::pair<const K, std::pair<control, T>>& item)
+		// Drop values which don't need to be written (index-only mode, exclusive access)
+		void evict()
+		{
+			std::size_t keep = 0;
+
+			for (item_type* item : m_resident)
+			{
+				if (item->second.first.order)
+				{
+					item->second.second = {};
+					item->second.first.resident = false;
+				}
+				else
+				{
+					m_resident[keep++] = item;
+				}
+			}
+
+			m_resident.resize(keep);
+		}
+
+		void dirty(item_type& item)
 		{
 			auto& ctrl = item.second.first;
 
@@ -301,97 +727,174 @@ namespace ssdb
 			{
 				xor_order(ctrl.order, ctrl.new_count ? ctrl.new_block : ctrl.load_block);
 				ctrl.order = 0;
+				m_dirty.push_back(&item);
 			}
 		}
 
-		void write(std::pair<const K, std::pair<control, T>>& item)
+		void write(item_type& item)
 		{
-			auto& ctrl = item.second.first;
-
-			// Initialize data
-			std::vector<uchar> buf = sstl::save([&](auto ctx)
+			const auto serialize = [&](auto ctx)
 			{
 				ctx(const_cast<K&>(item.first));
 				ctx(item.second.second);
-			});
+			};
+
+			// Zero-initialized blocks (padding in the last one)
+			std::vector<block_layout> sbuf(1);
+
+			// Serialize directly into the first block without probing, get the size if it doesn't fit
+			const std::size_t size = sstl::save_to(sbuf[0].data, sizeof(sbuf[0].data), serialize);
 
 			// Get number of blocks required
-			std::uint32_t count = static_cast<std::uint32_t>(buf.size() / sizeof(block_layout::data));
+			std::uint32_t count = static_cast<std::uint32_t>(size / sizeof(block_layout::data));
 
-			if (buf.size() % sizeof(block_layout::data))
+			if (size % sizeof(block_layout::data))
 			{
 				count += 1;
 			}
 
+			if (count > 1)
+			{
+				sbuf.clear();
+				sbuf.resize(count);
+
+				std::vector<sstl::segment> segs(count);
+
+				for (std::uint32_t i = 0; i < count; i++)
+				{
+					segs[i] = {reinterpret_cast<sstl::byte*>(sbuf[i].data), sizeof(sbuf[i].data)};
+				}
+
+				sstl::save_to(segs.data(), count, serialize);
+			}
+
+			for (std::uint32_t i = 0; i < count; i++)
+			{
+				sbuf[i].size = i == 0 ? size : -1;
+			}
+
+			write(item, sbuf);
+		}
+
+		// Write record blocks (size fields and data must be set)
+		void write(item_type& item, std::vector<block_layout>& sbuf)
+		{
+			auto& ctrl = item.second.first;
+
+			const std::uint32_t count = static_cast<std::uint32_t>(sbuf.size());
+
 			// Update order
 			dirty(item);
 			ctrl.order = ++m_order;
 
 			// Update blocks
+			if (!ctrl.new_count)
+			{
+				m_written.push_back(&item);
+			}
+
 			if (ctrl.new_count != count)
 			{
 				add_free(ctrl.new_block, ctrl.new_count);
-				ctrl.new_block = get_free(count);
+				ctrl.new_block = m_limit ? get_free_below(count, m_limit) : get_free(count);
 				ctrl.new_count = count;
 			}
 
 			xor_order(ctrl.order, ctrl.new_block);
 
-			block_layout sbuf{};
+			for (auto& block : sbuf)
+			{
+				block.order = ctrl.order;
+			}
 
-			for (std::uint32_t i = 0; i < count; i++)
+			if (m_data->write_blocks(ctrl.new_block, count, reinterpret_cast<uchar*>(sbuf.data())) != count)
 			{
-				sbuf.order = ctrl.order;
+				add_free(ctrl.new_block, ctrl.new_count);
+				xor_order(ctrl.order, ctrl.new_block);
+				ctrl.new_block = 0;
+				ctrl.new_count = 0;
+				ctrl.order = 0;
+				error(64);
+				m_order--;
 
-				if (i == 0)
-				{
-					sbuf.size = buf.size();
-				}
-				else
-				{
-					sbuf.size = -1;
-				}
+				// Retry later
+				m_dirty.push_back(&item);
+				return;
+			}
 
-				std::memcpy(sbuf.data, buf.data() + i * sizeof(sbuf.data), std::min(buf.size() - i * sizeof(sbuf.data), sizeof(sbuf.data)));
+			m_commit_blocks += count;
+		}
 
-				if (i && i == count - 1)
-				{
-					std::memset(sbuf.data + buf.size() - i * sizeof(sbuf.data), 0, count * sizeof(sbuf.data) - buf.size());
-				}
+		// Write all modified records
+		void write_dirty()
+		{
+			std::vector<item_type*> list;
+			list.swap(m_dirty);
 
-				if (!m_data->write_block(ctrl.new_block + i, reinterpret_cast<uchar*>(&sbuf)))
-				{
-					add_free(ctrl.new_block, ctrl.new_count);
-					xor_order(ctrl.order, ctrl.new_block);
-					ctrl.new_block = 0;
-					ctrl.new_count = 0;
-					ctrl.order = 0;
-					m_error |= 64;
-					m_order--;
-					break;
-				}
+			for (item_type* item : list)
+			{
+				write(*item);
+			}
+
+			// Reuse allocated memory
+			if (m_dirty.empty())
+			{
+				list.clear();
+				m_dirty.swap(list);
 			}
 		}
 
-		void finalize()
+		// Free blocks of the previous terminator after the current one became durable
+		void release_pending()
 		{
-			if (m_order <= m_flush)
+			for (const auto& range : m_pending)
 			{
-				return;
+				add_free(range.first, range.second);
 			}
 
-			for (auto& item : m_map)
+			m_pending.clear();
+			m_unsynced = false;
+		}
+
+		// Flush storage, old blocks stay pending if it failed
+		bool sync_storage()
+		{
+			if (!m_data->flush())
+			{
+				error(256);
+				return false;
+			}
+
+			release_pending();
+			return true;
+		}
+
+		// Commit changes (force writing new terminator if requested)
+		void finalize(bool force = false)
+		{
+			if (m_order <= m_flush && !force)
 			{
-				if (!item.second.first.order)
+				if (m_unsynced)
 				{
-					write(item);
+					// Make lazy terminator durable
+					sync_storage();
 				}
+
+				return;
 			}
 
-			m_data->flush();
+			metrics::span span(stats::commit_time);
+
+			write_dirty();
+
+			// Sync data along with the previous terminator (if lazy), retry on the next commit
+			if (!sync_storage())
+			{
+				return;
+			}
 
 			// Write terminator
-			const std::uint32_t new_pos = get_free(1);
+			const std::uint32_t new_pos = m_limit ? get_free_below(1, m_limit) : get_free(1);
 
 			block_layout term{};
 			term.order = ++m_order;
@@ -400,31 +903,87 @@ namespace ssdb
 			if (!m_data->write_block(new_pos, reinterpret_cast<uchar*>(&term)))
 			{
 				m_order--;
-				m_error |= 128;
+				error(128);
 				add_free(new_pos, 1);
 				return;
 			}
 
-			// Second flush (TODO: possibly avoid by combining with the following writes)
-			m_data->flush();
-			add_free(m_lastf, 1);
+			// Old blocks can't be reused until the new terminator is durable
+			if (m_lastf != -1)
+			{
+				m_pending.emplace_back(m_lastf, 1);
+			}
+
 			m_lastf = new_pos;
 			m_flush = m_order;
 
+			stats::commit_blocks.observe(m_commit_blocks + 1);
+			m_commit_blocks = 0;
+
 			// Update free space
-			for (auto& item : m_map)
 			{
-				control& ctrl = item.second.first;
+				std::lock_guard<std::mutex> lock(m_ctrl_mutex);
 
-				if (ctrl.new_count)
+				for (item_type* item : m_written)
 				{
-					add_free(ctrl.load_block, ctrl.load_count);
-					ctrl.load_block = ctrl.new_block;
-					ctrl.load_count = ctrl.new_count;
-					ctrl.new_block = 0;
-					ctrl.new_count = 0;
+					control& ctrl = item->second.first;
+
+					if (ctrl.new_count)
+					{
+						m_pending.emplace_back(ctrl.load_block, ctrl.load_count);
+						ctrl.load_block = ctrl.new_block;
+						ctrl.load_count = ctrl.new_count;
+						ctrl.new_block = 0;
+						ctrl.new_count = 0;
+					}
 				}
 			}
+
+			m_written.clear();
+			m_unsynced = true;
+
+			if (!m_lazy)
+			{
+				// Second flush
+				sync_storage();
+			}
+		}
+
+		// Finalize and share the commit with other flush callers, sync lazy terminator if requested (m_mutex must be locked)
+		void commit(bool sync)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex, std::adopt_lock);
+
+			const std::uint64_t order = m_order;
+
+			// Wait for the current group commit
+			while (m_committing)
+			{
+				m_cv.wait(lock);
+			}
+
+			if (m_window.count() && m_flush < order)
+			{
+				// Lead new group commit, other writers can add their data meanwhile
+				m_committing = true;
+
+				const auto until = std::chrono::steady_clock::now() + m_window;
+
+				while (m_cv.wait_until(lock, until) != std::cv_status::timeout)
+				{
+				}
+
+				finalize();
+				m_committing = false;
+				m_cv.notify_all();
+			}
+			else if (m_flush < order || (sync && m_unsynced))
+			{
+				finalize();
+			}
+
+			// Keep the mutex locked
+			lock.release();
 		}
 
 	public:
@@ -437,11 +996,184 @@ namespace ssdb
 		{
 			if (m_data)
 			{
+				m_lazy = false;
 				finalize();
 			}
 		}
 
-		void init(std::unique_ptr<sfs::view> view)
+		// Set group commit window (flush callers within it share one commit) and lazy terminator
+		// (commit completes with a single sync, but it's only durable after the next commit or flush)
+		void set_group_commit(std::chrono::microseconds window, bool lazy)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_window = window;
+			m_lazy = lazy;
+		}
+
+		// Keep only keys and record locations in memory, values are read from the storage on demand
+		// (use reader::load(), writer loads values it accesses until the next writer; set before init)
+		void set_index_only(bool index)
+		{
+			m_index = index;
+		}
+
+		// Move up to budget blocks of records from the end of the file to the free space below and shrink the file (returns number of blocks moved)
+		std::uint32_t compact(std::uint32_t budget)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			if (!m_data)
+			{
+				return 0;
+			}
+
+			// Commit pending changes first
+			finalize();
+
+			std::uint32_t moved = 0;
+
+			std::vector<block_layout> sbuf;
+			std::vector<uchar> buf;
+
+			// Scan records from the end
+			for (std::uint32_t end = used_below(static_cast<std::uint32_t>(m_data->count())); end && moved < budget;)
+			{
+				if (end - 1 == m_lastf)
+				{
+					if (!has_free_below(1, m_lastf))
+					{
+						break;
+					}
+
+					// Move the terminator with an empty commit
+					m_limit = m_lastf;
+					finalize(true);
+					m_limit = 0;
+
+					if (m_lastf == end - 1)
+					{
+						break;
+					}
+
+					moved += 1;
+					end = used_below(end - 1);
+					continue;
+				}
+
+				// Find the first block of the last record
+				block_layout last;
+
+				if (!m_data->read_block(end - 1, reinterpret_cast<uchar*>(&last)) || last.size == 0)
+				{
+					// Old terminator waiting for the sync
+					break;
+				}
+
+				std::uint32_t first = end - 1;
+
+				// Collect the blocks backwards
+				sbuf.assign(1, last);
+
+				while (sbuf.back().size == -1 && first > 0)
+				{
+					block_layout prev;
+
+					if (!m_data->read_block(first - 1, reinterpret_cast<uchar*>(&prev)) || prev.order != last.order)
+					{
+						break;
+					}
+
+					sbuf.push_back(prev);
+					first--;
+				}
+
+				std::reverse(sbuf.begin(), sbuf.end());
+
+				if (sbuf[0].size == -1 || sbuf[0].size >= (1u << 31))
+				{
+					break;
+				}
+
+				const uchar* data = assemble(sbuf, buf);
+
+				if (!data)
+				{
+					break;
+				}
+
+				sstl::context_data ctx(sstl::context_type::reading, reinterpret_cast<sstl::byte*>(const_cast<uchar*>(data)), static_cast<std::size_t>(sbuf[0].size));
+
+				K key{};
+				ctx.traverse<sstl::context_type::reading>(key);
+
+				const auto found = m_map.find(key);
+
+				if (found == m_map.end())
+				{
+					break;
+				}
+
+				control& ctrl = found->second.first;
+
+				// Must be the current committed location (or space waiting for the sync)
+				if (ctrl.order != last.order || ctrl.load_block != first || ctrl.load_count != end - first || ctrl.new_count)
+				{
+					break;
+				}
+
+				if (!has_free_below(ctrl.load_count, first))
+				{
+					break;
+				}
+
+				// Rewrite the same blocks below the current location (value may be not resident)
+				{
+					std::lock_guard<std::mutex> lock(m_ctrl_mutex);
+
+					const std::uint64_t order = ctrl.order;
+
+					m_limit = first;
+					dirty(*found);
+					m_dirty.pop_back();
+					write(*found, sbuf);
+					m_limit = 0;
+
+					if (!ctrl.order)
+					{
+						// Write failed: keep the current location
+						m_dirty.pop_back();
+						ctrl.order = order;
+						xor_order(order, ctrl.load_block);
+						break;
+					}
+				}
+
+				moved += end - first;
+				end = used_below(first);
+			}
+
+			if (moved)
+			{
+				// Terminator is also allocated as low as possible
+				m_limit = static_cast<std::uint32_t>(m_data->count());
+				finalize();
+				m_limit = 0;
+			}
+
+			// Shrink the file (old blocks may be still waiting for the sync if lazy)
+			const std::uint32_t end = used_below(static_cast<std::uint32_t>(m_data->count()));
+
+			if (end < m_data->count())
+			{
+				m_data->trunc(std::uint64_t{end} * sfs::block_size);
+			}
+
+			return moved;
+		}
+
+		// Open storage, progress callback receives the number of blocks read and the total number
+		void init(std::unique_ptr<sfs::view> view, const std::function<void(std::uint64_t, std::uint64_t)>& progress = nullptr)
 		{
 			if (view)
 			{
@@ -450,8 +1182,7 @@ namespace ssdb
 
 			if (m_data)
 			{
-				m_flush = -1;
-				reload();
+				reload(progress);
 
 				if (m_lastf == -1)
 				{
@@ -471,11 +1202,12 @@ namespace ssdb
 			{
 			}
 
+			// Get the value (returns nullptr for non-resident values in index-only mode, use load())
 			const T* operator [](const K& key) const
 			{
 				const auto found = m_ref.m_map.find(key);
 
-				if (found == m_ref.m_map.end())
+				if (found == m_ref.m_map.end() || (m_ref.m_index && !found->second.first.resident))
 				{
 					return nullptr;
 				}
@@ -483,13 +1215,30 @@ namespace ssdb
 				return &found->second.second;
 			}
 
+			// Copy the value, read it from the storage if necessary (works in all modes)
+			bool load(const K& key, T& value) const
+			{
+				const auto found = m_ref.m_map.find(key);
+
+				if (found == m_ref.m_map.end())
+				{
+					return false;
+				}
+
+				return m_ref.copy(*found, value);
+			}
+
+			// Iteration gives all keys, the value is nullptr if not resident (index-only mode, use load())
 			class iterator
 			{
-				typename std::unordered_map<K, std::pair<control, T>, H>::const_iterator m_it;
+				typename map_type::const_iterator m_it;
+
+				bool m_index;
 
 			public:
-				iterator(decltype(m_it) it)
+				iterator(decltype(m_it) it, bool index)
 					: m_it(std::move(it))
+					, m_index(index)
 				{
 				}
 
@@ -506,11 +1255,17 @@ namespace ssdb
 				struct ref_pair
 				{
 					const K& first;
-					const T& second;
-				}
-				operator *() const
+					const T* second;
+				};
+
+				ref_pair operator *() const
 				{
-					return {m_it->first, m_it->second.second};
+					if (m_index && !m_it->second.first.resident)
+					{
+						return {m_it->first, nullptr};
+					}
+
+					return {m_it->first, &m_it->second.second};
 				}
 
 				auto& operator ++()
@@ -522,19 +1277,20 @@ namespace ssdb
 
 			iterator begin() const
 			{
-				return {m_ref.m_map.cbegin()};
+				return {m_ref.m_map.cbegin(), m_ref.m_index};
 			}
 
 			iterator end() const
 			{
-				return {m_ref.m_map.cend()};
+				return {m_ref.m_map.cend(), m_ref.m_index};
 			}
 		};
 
+		// Run concurrently with other readers and with the commit of a writer
 		template <typename F>
 		auto read(F&& read_op)
 		{
-			std::lock_guard<std::mutex> lock(m_mutex);
+			auto lock = lock_shared();
 
 			return std::forward<F>(read_op)(reader{*this});
 		}
@@ -547,37 +1303,58 @@ namespace ssdb
 			bool m_modify = false;
 			bool m_flush;
 
+			// Exclusive map access
+			std::unique_lock<std::shared_timed_mutex> m_lock;
+
 		public:
 			writer(umap& ref, bool flush = false)
 				: m_ref(ref)
 				, m_flush(flush)
+				, m_lock(ref.lock_unique())
+			{
+				if (m_ref.m_index)
+				{
+					m_ref.evict();
+				}
+			}
+
+			// Required for passing by value before C++17 (normally elided)
+			writer(writer&& r)
+				: m_ref(r.m_ref)
+				, m_modify(r.m_modify)
+				, m_flush(r.m_flush)
+				, m_lock(std::move(r.m_lock))
 			{
 			}
 
 			~writer()
 			{
+				if (!m_lock)
+				{
+					// Moved from
+					return;
+				}
+
+				// Writing and commit only read the map, allow readers
+				m_lock.unlock();
+
 				if (m_modify)
 				{
-					for (auto& item : m_ref.m_map)
-					{
-						if (!item.second.first.order)
-						{
-							m_ref.write(item);
-						}
-					}
+					m_ref.write_dirty();
 				}
 
 				if (m_flush)
 				{
-					m_ref.finalize();
+					m_ref.commit(false);
 				}
 			}
 
+			// Get the value for modification (nullptr if not found or can't be loaded)
 			T* operator [](const K& key)
 			{
 				const auto found = m_ref.m_map.find(key);
 
-				if (found == m_ref.m_map.end())
+				if (found == m_ref.m_map.end() || !m_ref.fetch(*found))
 				{
 					return nullptr;
 				}
@@ -599,7 +1376,23 @@ namespace ssdb
 						std::forward_as_tuple(null_control),
 						std::forward_as_tuple(std::forward<Args>(args)...)));
 
-				if (Modify || res.second)
+				if (res.second)
+				{
+					// New record (order == 0)
+					m_modify = true;
+					m_ref.m_dirty.push_back(&*res.first);
+
+					if (m_ref.m_index)
+					{
+						res.first->second.first.resident = true;
+						m_ref.m_resident.push_back(&*res.first);
+					}
+				}
+				else if (!m_ref.fetch(*res.first))
+				{
+					return nullptr;
+				}
+				else if (Modify)
 				{
 					m_modify = true;
 					m_ref.dirty(*res.first);
@@ -617,7 +1410,7 @@ namespace ssdb
 					return nullptr;
 				}
 
-				return &found->second.second;
+				return m_ref.fetch(*found);
 			}
 		};
 
@@ -637,11 +1430,12 @@ namespace ssdb
 			return std::forward<F>(write_op)(writer{*this, true});
 		}
 
+		// Commit changes and make them durable
 		void flush()
 		{
 			std::lock_guard<std::mutex> lock(m_mutex);
 
-			finalize();
+			commit(true);
 		}
 	};
 
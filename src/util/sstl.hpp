@@ -69,10 +69,14 @@ std::shared_ptr:
 std::array of simple type:
 std::vector of simple type:
 std::basic_string<SimpleType>:
- - sized buffer
+ - sized buffer (size in bytes, big-endian elements, converted in bulk)
 
 std::bitset<N>:
- - compressed sized buffer
+ - compressed sized buffer (bit i in byte i / 8, trailing zero bytes omitted)
+
+sstl::view<SimpleType>:
+ - sized buffer (compatible with std::vector and std::basic_string), read as a view of the input data
+ - views read by sstl::stream_reader are only valid until the next read
 
 std::array for complex types:
 std::deque:
@@ -263,33 +267,172 @@ namespace sstl
 		}
 	};
 
+	// Reverse bytes of every element (simple loops allow auto-vectorization)
+	template <std::size_t Size>
+	struct swap_bytes
+	{
+		static void copy(uchar* dst, const uchar* src, std::size_t count)
+		{
+			for (std::size_t i = 0; i < count; i++, dst += Size, src += Size)
+			{
+				for (std::size_t j = 0; j < Size / 2; j++)
+				{
+					const uchar a = src[j];
+					const uchar b = src[Size - 1 - j];
+					dst[j] = b;
+					dst[Size - 1 - j] = a;
+				}
+			}
+		}
+	};
+
+	template <>
+	struct swap_bytes<2>
+	{
+		static void copy(uchar* dst, const uchar* src, std::size_t count)
+		{
+			for (std::size_t i = 0; i < count; i++)
+			{
+				std::uint16_t v;
+				std::memcpy(&v, src + i * 2, 2);
+				v = static_cast<std::uint16_t>((v >> 8) | (v << 8));
+				std::memcpy(dst + i * 2, &v, 2);
+			}
+		}
+	};
+
+	template <>
+	struct swap_bytes<4>
+	{
+		static void copy(uchar* dst, const uchar* src, std::size_t count)
+		{
+			for (std::size_t i = 0; i < count; i++)
+			{
+				std::uint32_t v;
+				std::memcpy(&v, src + i * 4, 4);
+				v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+				std::memcpy(dst + i * 4, &v, 4);
+			}
+		}
+	};
+
+	template <>
+	struct swap_bytes<8>
+	{
+		static void copy(uchar* dst, const uchar* src, std::size_t count)
+		{
+			for (std::size_t i = 0; i < count; i++)
+			{
+				std::uint64_t v;
+				std::memcpy(&v, src + i * 8, 8);
+				v = ((v & 0x00ff00ff00ff00ffull) << 8) | ((v >> 8) & 0x00ff00ff00ff00ffull);
+				v = ((v & 0x0000ffff0000ffffull) << 16) | ((v >> 16) & 0x0000ffff0000ffffull);
+				v = (v << 32) | (v >> 32);
+				std::memcpy(dst + i * 8, &v, 8);
+			}
+		}
+	};
+
+	// Check if simple values are stored as is
+	template <typename T>
+	constexpr bool is_raw_copy()
+	{
+		return sizeof(T) == 1 || std::is_same<typename is_simple<T>::data_type, T>::value || std::endian::native == std::endian::big;
+	}
+
+	// Convert array of simple values to the serialized form or back (in bulk)
+	template <typename T>
+	void copy_simple(void* dst, const void* src, std::size_t count)
+	{
+		if (is_raw_copy<T>())
+		{
+			std::memmove(dst, src, count * sizeof(T));
+		}
+		else
+		{
+			swap_bytes<sizeof(T)>::copy(static_cast<uchar*>(dst), static_cast<const uchar*>(src), count);
+		}
+	}
+
 	template <context_type Type, typename T, typename = void>
 	struct traverse;
 
+	// Output buffer for segmented writing
+	struct segment
+	{
+		byte* data;
+		std::size_t size;
+	};
+
+	// Output sink for streaming (returns false to abort)
+	using sink_type = std::function<bool(const void* data, std::size_t size)>;
+
 	struct context_data
 	{
 		using ptr_type = byte*;
 
-		context_data(context_type type, ptr_type begin = {}, std::size_t size = 0)
+		context_data(context_type /*type*/, ptr_type begin = {}, std::size_t size = 0)
 			: begin(begin)
 			, end(begin + size)
-			, psize(size)
+			, psize(0)
+		{
+		}
+
+		// Writing into the sequence of segments
+		context_data(const segment* segs, std::size_t count)
+			: begin(count ? segs[0].data : nullptr)
+			, end(count ? segs[0].data + segs[0].size : nullptr)
+			, psize(0)
+			, segs(count ? segs + 1 : nullptr)
+			, segs_end(count ? segs + count : nullptr)
+		{
+		}
+
+		// Writing into the buffer which is passed to the sink when full
+		context_data(ptr_type buf, std::size_t size, const sink_type& sink)
+			: begin(buf)
+			, end(buf + size)
+			, psize(0)
+			, base(buf)
+			, sink(&sink)
 		{
-			if (type == context_type::reading)
-			{
-				psize = 0;
-			}
 		}
 
 		// Data begin
 		ptr_type begin;
 
 		// Data end
-		const ptr_type end;
+		ptr_type end;
 
-		// Current size (probing); current recursion level (reading)
+		// Serialized size (probing, writing); current recursion level (reading)
 		std::size_t psize;
 
+		// Next output segments (writing)
+		const segment* segs = nullptr;
+		const segment* segs_end = nullptr;
+
+		// Stream buffer and sink (writing)
+		ptr_type base = nullptr;
+		const sink_type* sink = nullptr;
+
+		// Pass buffered data to the sink (on failure, continue as probing)
+		bool flush()
+		{
+			if (begin && sink && begin != base)
+			{
+				if (!(*sink)(base, static_cast<std::size_t>(begin - base)))
+				{
+					begin = nullptr;
+					end = nullptr;
+					return false;
+				}
+
+				begin = base;
+			}
+
+			return begin != nullptr;
+		}
+
 		// Get remaining size
 		std::size_t remaining() const
 		{
@@ -439,17 +582,93 @@ namespace sstl
 			}
 		}
 
-		// Write data (raw)
+		// Write data (raw), on output buffer overflow only the size is counted
 		void write(const void* data, std::size_t _size)
 		{
+			psize += _size;
+
 			if (begin)
 			{
+				// Continue in the next segment
+				while (_size > remaining() && segs != segs_end)
+				{
+					const std::size_t part = remaining();
+					std::memcpy(begin, data, part);
+					data = static_cast<const uchar*>(data) + part;
+					_size -= part;
+					begin = segs->data;
+					end = segs->data + segs->size;
+					segs++;
+				}
+
+				// Pass full buffer to the sink
+				while (sink && _size > remaining())
+				{
+					if (begin == base)
+					{
+						// Large data bypasses the buffer
+						if (!(*sink)(data, _size))
+						{
+							begin = nullptr;
+							end = nullptr;
+						}
+
+						return;
+					}
+
+					const std::size_t part = remaining();
+					std::memcpy(begin, data, part);
+					data = static_cast<const uchar*>(data) + part;
+					_size -= part;
+					begin = end;
+
+					if (!flush())
+					{
+						return;
+					}
+				}
+
+				if (_size > remaining())
+				{
+					// Overflow: continue as probing
+					begin = nullptr;
+					end = nullptr;
+					return;
+				}
+
 				std::memcpy(begin, data, _size);
 				begin += _size;
 			}
-			else
+		}
+
+		// Write simple values in serialized form
+		template <typename T>
+		void write_simple(const T* data, std::size_t count)
+		{
+			if (is_raw_copy<T>())
+			{
+				write(data, count * sizeof(T));
+				return;
+			}
+
+			if (begin && remaining() >= count * sizeof(T))
+			{
+				// Convert directly into the output
+				copy_simple<T>(begin, data, count);
+				begin += count * sizeof(T);
+				psize += count * sizeof(T);
+				return;
+			}
+
+			// Convert by parts (segmented output, overflow or probing)
+			uchar buf[1024];
+
+			for (std::size_t i = 0; i < count;)
 			{
-				psize += _size;
+				const std::size_t n = std::min<std::size_t>(count - i, sizeof(buf) / sizeof(T));
+				copy_simple<T>(buf, data + i, begin ? n : 0);
+				write(buf, n * sizeof(T));
+				i += n;
 			}
 		}
 
@@ -489,16 +708,7 @@ namespace sstl
 
 			*this += _size.type_sized();
 			*this += _size;
-
-			if (begin)
-			{
-				std::memcpy(begin, data, _size.value);
-				begin += _size.value;
-			}
-			else
-			{
-				psize += _size.value;
-			}
+			write(data, _size.value);
 		}
 
 		template <context_type Type, typename T>
@@ -566,21 +776,13 @@ namespace sstl
 					// Empty container optimization
 					*this += byte::bit_false;
 				}
-				else if (sizeof(typename T::value_type) == 1)
-				{
-					// Byte array optimization (std::string, etc)
-					write_sized(&arg.front(), arg.size());
-				}
 				else
 				{
-					const size_type size = arg.size() * sizeof(T);
+					// Size in bytes
+					const size_type size = arg.size() * sizeof(typename T::value_type);
 					*this += size.type_sized();
 					*this += size;
-
-					for (typename is_simple<typename T::value_type>::data_type value : arg)
-					{
-						*this += value;
-					}
+					write_simple(&arg.front(), arg.size());
 				}
 
 				return;
@@ -601,30 +803,16 @@ namespace sstl
 			if (*begin == byte::u8_sized || *begin == byte::u32_sized || *begin == byte::u64_sized)
 			{
 				const std::size_t size = read_size(*begin++);
-				is_simple<T>::resize(arg, size);
+				const std::size_t count = size / sizeof(typename T::value_type);
+				is_simple<T>::resize(arg, count);
 
-				if (sizeof(typename T::value_type) == 1)
+				// Fixed-size containers may be smaller or larger
+				if (const std::size_t n = std::min<std::size_t>(arg.size(), count))
 				{
-					std::memcpy(&arg.front(), begin, std::min<std::size_t>(arg.size(), size));
-					begin += size;
-				}
-				else
-				{
-					const auto last = begin + sizeof(typename T::value_type) * size;
-
-					for (auto& value : arg)
-					{
-						if (begin < last)
-						{
-							typename is_simple<typename T::value_type>::data_type data;
-							read(&data, sizeof(typename T::value_type));
-							value = data;
-						}
-					}
-
-					begin = last;
+					copy_simple<typename T::value_type>(&arg.front(), begin, n);
 				}
 
+				begin += size;
 				return;
 			}
 
@@ -844,6 +1032,10 @@ namespace sstl
 		}
 	};
 
+	// Definition for ODR-use (C++14)
+	template <context_type Type, typename T>
+	constexpr byte traverse<Type, T, typename is_simple<T>::simple>::my_type;
+
 	template <context_type Type>
 	struct traverse<Type, bool>
 	{
@@ -937,46 +1129,39 @@ namespace sstl
 	template <context_type Type, std::size_t N>
 	struct traverse<Type, std::bitset<N>, void>
 	{
-		static_assert(!N, "std::bitset<> support is incomplete");
+		// Bit i is stored in byte i / 8 as (1 << i % 8)
+		static constexpr std::size_t s_bytes = (N + 7) / 8;
 
 		static void op(context_data& ctx, std::bitset<N>& arg)
 		{
 			if (Type != context_type::reading)
 			{
-				size_type size = 0;
+				uchar buf[s_bytes + 1]{};
 
-				// Get buffer size with empty tail optimization
-				for (std::size_t i = arg.none() ? N : 0; i < N; i++)
-				{
-					if (arg[i]) size.value = i / 8 + 1;
-				}
+				// Convert by 64-bit words
+				std::bitset<N> bits = arg;
 
-				if (size.value == 0)
-				{
-					ctx += byte::bit_false;
-				}
-				else
+				for (std::size_t i = 0; i < s_bytes; i += 8)
 				{
-					ctx += size.type_sized();
-					ctx += size;
+					const std::uint64_t word = (bits & std::bitset<N>(UINT64_MAX)).to_ullong();
 
-					if (ctx.begin)
+					for (std::size_t j = 0; j < 8 && i + j < s_bytes; j++)
 					{
-						std::memset(ctx.begin, 0, size);
+						buf[i + j] = static_cast<uchar>(word >> (j * 8));
+					}
 
-						for (std::size_t i = 0; i < N; i++)
-						{
-							if (arg[i]) ctx.begin[i / 8] |= 1 << (i % 8);
-						}
+					bits >>= 64;
+				}
 
-						ctx.begin += size.value;
-					}
-					else
-					{
-						ctx.psize += size.value;
-					}
+				// Empty tail optimization
+				std::size_t size = s_bytes;
+
+				while (size && !buf[size - 1])
+				{
+					size--;
 				}
 
+				ctx.write_sized(buf, size);
 				return;
 			}
 
@@ -995,10 +1180,25 @@ namespace sstl
 			if (*ctx.begin == byte::u8_sized || *ctx.begin == byte::u32_sized || *ctx.begin == byte::u64_sized)
 			{
 				const std::size_t size = ctx.read_size(*ctx.begin++);
+				const std::size_t count = size < s_bytes ? size : s_bytes;
+				const uchar* src = reinterpret_cast<const uchar*>(ctx.begin);
+
+				arg.reset();
 
-				for (std::size_t i = 0, m = std::min<std::size_t>(N, 8 * size); i < m; i++)
+				// Convert by 64-bit words starting from the highest (excessive bits are ignored)
+				for (std::size_t i = (count + 7) / 8 * 8; i > 0;)
 				{
-					arg.set(i, ctx.begin[i / 8] & (1 << (i % 8)) != 0);
+					i -= 8;
+
+					std::uint64_t word = 0;
+
+					for (std::size_t j = 0; j < 8 && i + j < count; j++)
+					{
+						word |= std::uint64_t{src[i + j]} << (j * 8);
+					}
+
+					arg <<= 64;
+					arg |= std::bitset<N>(word);
 				}
 
 				ctx.begin += size;
@@ -1015,6 +1215,111 @@ namespace sstl
 		}
 	};
 
+	// Non-owning view of simple container data in the serialized form (big-endian)
+	// When loaded, points into the input buffer and remains valid while it exists
+	template <typename T>
+	class view
+	{
+	public:
+		using data_type = typename is_simple<T>::data_type;
+
+		static_assert(alignof(data_type) == 1, "sstl::view<> requires arithmetic or enum type");
+
+	private:
+		const data_type* m_data = nullptr;
+
+		std::size_t m_size = 0;
+
+	public:
+		constexpr view() = default;
+
+		constexpr view(const data_type* data, std::size_t size)
+			: m_data(data)
+			, m_size(size)
+		{
+		}
+
+		const data_type* data() const
+		{
+			return m_data;
+		}
+
+		std::size_t size() const
+		{
+			return m_size;
+		}
+
+		bool empty() const
+		{
+			return m_size == 0;
+		}
+
+		T operator [](std::size_t index) const
+		{
+			return m_data[index];
+		}
+
+		const data_type* begin() const
+		{
+			return m_data;
+		}
+
+		const data_type* end() const
+		{
+			return m_data + m_size;
+		}
+
+		// Convert to container (std::vector, std::basic_string)
+		template <typename CT>
+		CT to() const
+		{
+			return CT(begin(), end());
+		}
+	};
+
+	template <context_type Type, typename T>
+	struct traverse<Type, view<T>, void>
+	{
+		static void op(context_data& ctx, view<T>& arg)
+		{
+			using data_type = typename view<T>::data_type;
+
+			if (Type != context_type::reading)
+			{
+				ctx.write_sized(arg.data(), arg.size() * sizeof(data_type));
+				return;
+			}
+
+			if (ctx.remaining() == 0)
+			{
+				return;
+			}
+
+			if (*ctx.begin == byte::bit_false)
+			{
+				ctx.begin += 1;
+				arg = {};
+				return;
+			}
+
+			if (*ctx.begin == byte::u8_sized || *ctx.begin == byte::u32_sized || *ctx.begin == byte::u64_sized)
+			{
+				const std::size_t size = ctx.read_size(*ctx.begin++);
+				arg = {reinterpret_cast<const data_type*>(ctx.begin), size / sizeof(data_type)};
+				ctx.begin += size;
+				return;
+			}
+
+			if (*ctx.begin == byte::null_value)
+			{
+				ctx.begin += 1;
+				return;
+			}
+
+			ctx.drop();
+		}
+	};
+
 	template <context_type Type, typename T, typename D>
 	struct traverse<Type, std::unique_ptr<T, D>, void>
 	{
@@ -1253,7 +1558,7 @@ namespace sstl
 				{
 					K key{};
 					ctx(key);
-					ctx(map.emplace_hint(map.cend(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple()).first->second);
+					ctx(map.emplace_hint(map.cend(), std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple())->second);
 				}
 			});
 		};
@@ -1347,7 +1652,7 @@ namespace sstl
 		context_data ctx(context_type::reading, static_cast<byte*>(const_cast<void*>(data)), size);
 		serialize(context<context_type::reading>{ctx});
 
-		return ctx.begin - data;
+		return ctx.begin - static_cast<const byte*>(data);
 	}
 
 	template <typename T, typename F>
@@ -1390,4 +1695,285 @@ namespace sstl
 		append(result, std::forward<F>(serialize));
 		return result;
 	}
+
+	// Get serialized size
+	template <typename F>
+	std::size_t size_of(F&& serialize)
+	{
+		context_data probe(context_type::probing);
+		serialize(context<context_type::probing>{probe});
+
+		return probe.psize;
+	}
+
+	// Serialize into caller-provided segments filled in order, without probing.
+	// Returns serialized size: if it exceeds the total size of segments, the output is incomplete.
+	template <typename F>
+	std::size_t save_to(const segment* segs, std::size_t count, F&& serialize)
+	{
+		context_data ctx(segs, count);
+		serialize(context<context_type::writing>{ctx});
+
+		return ctx.psize;
+	}
+
+	// Serialize into caller-provided buffer (same as above)
+	template <typename F>
+	std::size_t save_to(void* out, std::size_t size, F&& serialize)
+	{
+		const segment seg{static_cast<byte*>(out), size};
+		return save_to(&seg, 1, std::forward<F>(serialize));
+	}
+
+	// Serialize through the sink (socket, file, etc) in chunks of the buffer size, without probing.
+	// Returns serialized size, or 0 if the sink failed.
+	template <typename F>
+	std::size_t save_stream(void* buf, std::size_t size, const sink_type& sink, F&& serialize)
+	{
+		context_data ctx(static_cast<byte*>(buf), size, sink);
+		serialize(context<context_type::writing>{ctx});
+
+		return ctx.flush() ? ctx.psize : 0;
+	}
+
+	template <typename F>
+	std::size_t save_stream(const sink_type& sink, F&& serialize, std::size_t chunk = 4096)
+	{
+		const std::unique_ptr<byte[]> buf(new byte[chunk]);
+		return save_stream(buf.get(), chunk, sink, std::forward<F>(serialize));
+	}
+
+	// Incremental reader of top-level values from the source (socket, file, etc).
+	// Data is pulled only when the next value is incomplete, so only one value is buffered at a time.
+	class stream_reader final
+	{
+	public:
+		// Read up to size bytes (returns 0 on EOF or error)
+		using source_type = std::function<std::size_t(void* data, std::size_t size)>;
+
+	private:
+		source_type m_source;
+
+		std::unique_ptr<byte[]> m_buf;
+
+		// Buffer capacity
+		std::size_t m_cap = 0;
+
+		// Max buffered size (value size limit)
+		std::size_t m_max;
+
+		// Consumed and buffered data
+		std::size_t m_pos = 0;
+		std::size_t m_size = 0;
+
+		// Scanned part of the current value and its document level
+		std::size_t m_scan = 0;
+		std::size_t m_level = 0;
+
+		bool m_eof = false;
+
+		// Invalid data or size limit reached
+		bool m_error = false;
+
+		// Scan buffered data for the end of the next value (returns its size or 0 if more data is needed)
+		std::size_t scan()
+		{
+			const byte* data = m_buf.get() + m_pos;
+			const std::size_t avail = m_size - m_pos;
+
+			while (m_scan < avail)
+			{
+				const byte b = data[m_scan];
+
+				std::size_t len = 1;
+				bool meta = false;
+
+				switch (b)
+				{
+				case byte::terminator:
+				{
+					if (m_level == 0)
+					{
+						// Stray terminator: abort
+						m_error = true;
+						return 0;
+					}
+
+					m_level--;
+					break;
+				}
+				case byte::document:
+				{
+					if (++m_level >= context_data::max_level())
+					{
+						m_error = true;
+						return 0;
+					}
+
+					break;
+				}
+				case byte::null_value:
+				case byte::bit_false:
+				case byte::bit_true:
+				{
+					break;
+				}
+				case byte::u8_value: len = 2; break;
+				case byte::u32_value: len = 5; break;
+				case byte::u64_value: len = 9; break;
+				case byte::u8_sized:
+				case byte::u32_sized:
+				case byte::u64_sized:
+				{
+					len = b == byte::u8_sized ? 2 : b == byte::u32_sized ? 5 : 9;
+
+					if (avail - m_scan < len)
+					{
+						return 0;
+					}
+
+					std::uint64_t size = 0;
+
+					for (std::size_t i = 1; i < len; i++)
+					{
+						size = size << 8 | static_cast<uchar>(data[m_scan + i]);
+					}
+
+					if (size > m_max)
+					{
+						m_error = true;
+						return 0;
+					}
+
+					len += static_cast<std::size_t>(size);
+					break;
+				}
+				default:
+				{
+					if (b < byte::null_value)
+					{
+						// Reserved bytes: abort
+						m_error = true;
+						return 0;
+					}
+
+					// Metadata (precedes the value)
+					meta = true;
+				}
+				}
+
+				if (avail - m_scan < len)
+				{
+					return 0;
+				}
+
+				m_scan += len;
+
+				if (!meta && m_level == 0)
+				{
+					return m_scan;
+				}
+			}
+
+			return 0;
+		}
+
+		// Pull more data from the source
+		bool fill()
+		{
+			if (m_eof || m_error)
+			{
+				return false;
+			}
+
+			if (m_pos)
+			{
+				// Discard consumed data
+				std::memmove(m_buf.get(), m_buf.get() + m_pos, m_size - m_pos);
+				m_size -= m_pos;
+				m_pos = 0;
+			}
+
+			if (m_size == m_cap)
+			{
+				if (m_cap >= m_max)
+				{
+					m_error = true;
+					return false;
+				}
+
+				const std::size_t cap = std::min(std::max<std::size_t>(m_cap * 2, 4096), m_max);
+				std::unique_ptr<byte[]> buf(new byte[cap]);
+
+				if (m_size)
+				{
+					std::memcpy(buf.get(), m_buf.get(), m_size);
+				}
+
+				m_buf = std::move(buf);
+				m_cap = cap;
+			}
+
+			const std::size_t got = m_source(m_buf.get() + m_size, m_cap - m_size);
+
+			if (got == 0)
+			{
+				m_eof = true;
+				return false;
+			}
+
+			m_size += got;
+			return true;
+		}
+
+	public:
+		explicit stream_reader(source_type source, std::size_t max_size = 64 * 1024 * 1024)
+			: m_source(std::move(source))
+			, m_max(max_size)
+		{
+		}
+
+		stream_reader(const stream_reader&) = delete;
+
+		// Load next value (returns false on EOF, error, or if the value is too large)
+		template <typename T>
+		bool read(T& value)
+		{
+			std::size_t size;
+
+			while (!(size = scan()))
+			{
+				if (m_error)
+				{
+					return false;
+				}
+
+				if (!fill())
+				{
+					if (m_error || m_pos == m_size)
+					{
+						return false;
+					}
+
+					// EOF terminates all documents: load the rest
+					size = m_size - m_pos;
+					break;
+				}
+			}
+
+			context_data ctx(context_type::reading, m_buf.get() + m_pos, size);
+			context<context_type::reading>{ctx}(value);
+
+			m_pos += size;
+			m_scan = 0;
+			m_level = 0;
+			return true;
+		}
+
+		// Check whether it failed because of invalid data or the size limit
+		bool error() const
+		{
+			return m_error;
+		}
+	};
 }